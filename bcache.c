@@ -0,0 +1,294 @@
+#include "kernel.h"
+#include "common.h"
+#include "bcache.h"
+
+// 磁區快取：雜湊索引 + LRU 淘汰，髒資料延後寫回
+static struct buf bufs[BCACHE_NBUF];
+static struct buf *buckets[BCACHE_NBUCKET];
+static struct buf *lru_head, *lru_tail;
+static struct wait_queue bcache_wait_queue;
+static struct bcache_stats stats;
+// 保護雜湊表、LRU、flags 與統計。磁碟 I/O 不持有這把鎖，
+// 期間由 BUF_BUSY 保證 buffer 不會被別人拿走。
+static struct spinlock bcache_lock;
+
+static void lru_remove(struct buf *b) {
+    if (b->lru_prev)
+        b->lru_prev->lru_next = b->lru_next;
+    else
+        lru_head = b->lru_next;
+    if (b->lru_next)
+        b->lru_next->lru_prev = b->lru_prev;
+    else
+        lru_tail = b->lru_prev;
+    b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_push_front(struct buf *b) {
+    b->lru_prev = NULL;
+    b->lru_next = lru_head;
+    if (lru_head)
+        lru_head->lru_prev = b;
+    else
+        lru_tail = b;
+    lru_head = b;
+}
+
+static void hash_remove(struct buf *b) {
+    struct buf **p = &buckets[b->sector % BCACHE_NBUCKET];
+    while (*p && *p != b)
+        p = &(*p)->hash_next;
+    if (*p)
+        *p = b->hash_next;
+    b->hash_next = NULL;
+}
+
+static void hash_insert(struct buf *b) {
+    struct buf **bucket = &buckets[b->sector % BCACHE_NBUCKET];
+    b->hash_next = *bucket;
+    *bucket = b;
+}
+
+static struct buf *hash_lookup(unsigned sector) {
+    struct buf *b = buckets[sector % BCACHE_NBUCKET];
+    while (b && b->sector != sector)
+        b = b->hash_next;
+    return b;
+}
+
+// 呼叫者持有 bcache_lock，睡眠期間暫時放開。
+// 開機階段沒有進程可以睡眠；那時只有單一執行流，不會遇到 BUSY
+static void bcache_wait(void) {
+    if (current_proc && current_proc != idle_proc)
+        sleep_on(&bcache_wait_queue, &bcache_lock);
+    else
+        PANIC("bcache: buffer busy during boot");
+}
+
+static void buf_release_locked(struct buf *b) {
+    b->flags &= ~BUF_BUSY;
+    wake_up(&bcache_wait_queue);
+}
+
+void bcache_init(void) {
+    for (int i = 0; i < BCACHE_NBUF; i++) {
+        // 尚未使用的 buffer 不放進雜湊表，只排在 LRU 尾端等著被取用
+        bufs[i].sector = (unsigned) -1;
+        lru_push_front(&bufs[i]);
+    }
+}
+
+// 取得 sector 的 buffer 並獨佔；內容不一定有效（見 BUF_VALID）
+struct buf *bget(unsigned sector) {
+    spin_lock(&bcache_lock);
+    while (1) {
+        struct buf *b = hash_lookup(sector);
+        if (b) {
+            if (b->flags & BUF_BUSY) {
+                bcache_wait();
+                continue;
+            }
+            b->flags |= BUF_BUSY;
+            lru_remove(b);
+            lru_push_front(b);
+            spin_unlock(&bcache_lock);
+            return b;
+        }
+
+        // 從 LRU 尾端找一個沒人持有的 buffer 回收
+        struct buf *victim = lru_tail;
+        while (victim && (victim->flags & BUF_BUSY))
+            victim = victim->lru_prev;
+        if (!victim) {
+            bcache_wait();
+            continue;
+        }
+
+        if (victim->flags & BUF_DIRTY) {
+            // 寫回期間可能睡眠，其他進程也許已經載入同一個 sector，寫完重新找
+            victim->flags |= BUF_BUSY;
+            spin_unlock(&bcache_lock);
+            int ret = read_write_disk(victim->data, victim->sector, true);
+            spin_lock(&bcache_lock);
+            if (ret == 0) {
+                stats.writebacks++;
+                victim->flags &= ~BUF_DIRTY;
+            } else {
+                // 寫不回去就保留髒資料，移到 LRU 前端，改找別的 buffer
+                lru_remove(victim);
+                lru_push_front(victim);
+            }
+            buf_release_locked(victim);
+            continue;
+        }
+
+        if (victim->flags & BUF_VALID)
+            stats.evictions++;
+        hash_remove(victim);
+        victim->sector = sector;
+        victim->flags = BUF_BUSY;
+        hash_insert(victim);
+        lru_remove(victim);
+        lru_push_front(victim);
+        spin_unlock(&bcache_lock);
+        return victim;
+    }
+}
+
+// 持有 BUF_BUSY 的進程可以不上鎖改 flags：其他人只會動不是 BUSY 的 buffer。
+// 讀取失敗時回傳 NULL，buffer 維持無效，下次 bread() 重新讀取磁碟。
+struct buf *bread(unsigned sector) {
+    struct buf *b = bget(sector);
+    bool hit = b->flags & BUF_VALID;
+    if (!hit && read_write_disk(b->data, sector, false) == 0)
+        b->flags |= BUF_VALID;
+
+    spin_lock(&bcache_lock);
+    if (hit)
+        stats.hits++;
+    else
+        stats.misses++;
+    if (!(b->flags & BUF_VALID)) {
+        buf_release_locked(b);
+        b = NULL;
+    }
+    spin_unlock(&bcache_lock);
+    return b;
+}
+
+// 立即寫回磁碟（用於 host 端會讀取的磁區）。失敗時回傳 -1，buffer 維持髒的
+int bwrite(struct buf *b) {
+    if (read_write_disk(b->data, b->sector, true) < 0) {
+        b->flags |= BUF_VALID | BUF_DIRTY;
+        return -1;
+    }
+    b->flags = (b->flags | BUF_VALID) & ~BUF_DIRTY;
+    return 0;
+}
+
+// 只標記為髒，等 bcache_flush() 或被淘汰時再寫回
+void bdirty(struct buf *b) {
+    b->flags |= BUF_VALID | BUF_DIRTY;
+}
+
+void brelse(struct buf *b) {
+    spin_lock(&bcache_lock);
+    buf_release_locked(b);
+    spin_unlock(&bcache_lock);
+}
+
+// 丟棄快取內容，下次 bread() 會重新讀取磁碟（用於 host 端改寫過的磁區）
+void bcache_invalidate(unsigned sector) {
+    struct buf *b;
+    spin_lock(&bcache_lock);
+    while ((b = hash_lookup(sector)) && (b->flags & BUF_BUSY))
+        bcache_wait();
+    if (b)
+        b->flags &= ~(BUF_VALID | BUF_DIRTY);
+    spin_unlock(&bcache_lock);
+}
+
+// 繞過快取直接存取磁碟前呼叫：寫回範圍內的髒資料，有寫不回去的回傳 -1。
+// 直接寫入磁碟之後以 invalidate 呼叫，丟棄快取（磁碟上的內容比較新）。
+int bcache_sync_range(unsigned sector, unsigned n, bool invalidate) {
+    int ret = 0;
+    spin_lock(&bcache_lock);
+    for (unsigned i = 0; i < n; i++) {
+        struct buf *b;
+        while ((b = hash_lookup(sector + i)) && (b->flags & BUF_BUSY))
+            bcache_wait();
+        if (!b)
+            continue;
+        if (b->flags & BUF_DIRTY) {
+            b->flags |= BUF_BUSY;
+            spin_unlock(&bcache_lock);
+            if (bwrite(b) < 0)
+                ret = -1;
+            spin_lock(&bcache_lock);
+            if (!(b->flags & BUF_DIRTY))
+                stats.writebacks++;
+            buf_release_locked(b);
+        }
+        if (invalidate)
+            b->flags &= ~(BUF_VALID | BUF_DIRTY);
+    }
+    spin_unlock(&bcache_lock);
+    return ret;
+}
+
+// 把所有髒 buffer 寫回。依 sector 排序後把相鄰的合併成一個多段請求，
+// 每批最多 VIRTIO_BLK_REQ_MAX 個請求，整批送出後只通知裝置一次。寫入失敗（或請求送不出去）的 buffer 維持髒的，
+// 下次再寫；有失敗時回傳 -1。
+int bcache_flush(void) {
+    struct buf *dirty[BCACHE_NBUF];
+    int n = 0;
+    spin_lock(&bcache_lock);
+    for (int i = 0; i < BCACHE_NBUF; i++) {
+        struct buf *b = &bufs[i];
+        if ((b->flags & (BUF_DIRTY | BUF_BUSY)) == BUF_DIRTY) {
+            b->flags |= BUF_BUSY;
+            dirty[n++] = b;
+        }
+    }
+    spin_unlock(&bcache_lock);
+
+    for (int i = 1; i < n; i++) {
+        struct buf *b = dirty[i];
+        int j = i - 1;
+        while (j >= 0 && dirty[j]->sector > b->sector) {
+            dirty[j + 1] = dirty[j];
+            j--;
+        }
+        dirty[j + 1] = b;
+    }
+
+    bool ok[BCACHE_NBUF];
+    for (int i = 0; i < n;) {
+        // 請求的槽位要到 virtio_blk_wait() 才釋放，一次送出超過 VIRTIO_BLK_REQ_MAX
+        // 個的話，多出來的那個會在 virtio_blk_submitv() 裡永遠等不到空位
+        struct blk_request *reqs[VIRTIO_BLK_REQ_MAX];
+        int req_first[VIRTIO_BLK_REQ_MAX + 1]; // 每個請求的第一個 buffer 在 dirty[] 中的位置
+        int nreqs = 0;
+        while (i < n && nreqs < VIRTIO_BLK_REQ_MAX) {
+            struct blk_iovec iov[BLK_MAX_SEGS];
+            int iovcnt = 0;
+            unsigned sector = dirty[i]->sector;
+            while (i + iovcnt < n && iovcnt < BLK_MAX_SEGS
+                   && dirty[i + iovcnt]->sector == sector + iovcnt) {
+                iov[iovcnt].base = dirty[i + iovcnt]->data;
+                iov[iovcnt].len = SECTOR_SIZE;
+                iovcnt++;
+            }
+            req_first[nreqs] = i;
+            reqs[nreqs++] = virtio_blk_submitv(sector, iov, iovcnt, true);
+            i += iovcnt;
+        }
+        req_first[nreqs] = i;
+
+        for (int r = 0; r < nreqs; r++) {
+            bool done = reqs[r] && virtio_blk_wait(reqs[r]) == 0;
+            for (int j = req_first[r]; j < req_first[r + 1]; j++)
+                ok[j] = done;
+        }
+    }
+
+    int ret = 0;
+    spin_lock(&bcache_lock);
+    for (int i = 0; i < n; i++) {
+        if (ok[i]) {
+            dirty[i]->flags &= ~BUF_DIRTY;
+            stats.writebacks++;
+        } else {
+            ret = -1;
+        }
+        buf_release_locked(dirty[i]);
+    }
+    spin_unlock(&bcache_lock);
+    return ret;
+}
+
+void bcache_get_stats(struct bcache_stats *out) {
+    spin_lock(&bcache_lock);
+    *out = stats;
+    spin_unlock(&bcache_lock);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "common.h"
+
+#define BCACHE_NBUF    64
+#define BCACHE_NBUCKET 31
+
+#define BUF_VALID 1 // data 與磁碟內容一致（或比磁碟新）
+#define BUF_DIRTY 2 // 尚未寫回磁碟
+#define BUF_BUSY  4 // 正被某個進程持有
+
+struct buf {
+    unsigned sector;
+    int flags;
+    struct buf *hash_next;
+    struct buf *lru_prev; // LRU 串列，head 為最近使用
+    struct buf *lru_next;
+    uint8_t data[SECTOR_SIZE];
+};
+
+void bcache_init(void);
+struct buf *bget(unsigned sector);
+struct buf *bread(unsigned sector);
+int bwrite(struct buf *b);
+void bdirty(struct buf *b);
+void brelse(struct buf *b);
+void bcache_invalidate(unsigned sector);
+int bcache_sync_range(unsigned sector, unsigned n, bool invalidate);
+int bcache_flush(void);
+void bcache_get_stats(struct bcache_stats *stats);
@@ -0,0 +1,158 @@
+#include "user.h"
+
+// memcpy/memset/strlen/strcmp 的微基準：以 rdcycle 量測，印出每個週期處理的位元組數。
+// 另外量一個逐位元組的版本當作對照，字組版本退步時一眼就看得出來。
+
+#define BENCH_BUF_SIZE  4096
+#define BENCH_BYTES     65536 // 每個項目大約處理這麼多位元組
+
+static uint8_t bench_src[BENCH_BUF_SIZE + 8] __attribute__((aligned(4)));
+static uint8_t bench_dst[BENCH_BUF_SIZE + 8] __attribute__((aligned(4)));
+
+static const uint32_t bench_sizes[] = { 8, 64, 512, 4096 };
+#define BENCH_NSIZES (sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+
+// 需要核心在 scounteren 開放 cycle 計數器
+static uint32_t rdcycle(void) {
+    uint32_t cycles;
+    __asm__ __volatile__("rdcycle %0" : "=r"(cycles));
+    return cycles;
+}
+
+static void bytewise_memcpy(void *dst, const void *src, size_t n) {
+    volatile uint8_t *d = dst;
+    const uint8_t *s = src;
+    while (n--)
+        *d++ = *s++;
+}
+
+// bytes / cycles，印到小數點後兩位
+static void print_rate(uint32_t bytes, uint32_t cycles) {
+    if (cycles == 0)
+        cycles = 1;
+    uint32_t rate = bytes * 100 / cycles;
+    printf(" %d.", rate / 100);
+    if (rate % 100 < 10)
+        putchar('0');
+    printf("%d", rate % 100);
+}
+
+enum { BENCH_MEMCPY, BENCH_MEMCPY_BYTEWISE, BENCH_MEMSET, BENCH_STRLEN, BENCH_STRCMP };
+
+// 回傳 iters 次操作花的週期數；分派放在計時迴圈外面
+static uint32_t bench_run(int op, uint8_t *dst, uint8_t *src, uint32_t size, uint32_t iters) {
+    volatile uint32_t sink = 0;
+    uint32_t start = rdcycle();
+    switch (op) {
+        case BENCH_MEMCPY:
+            for (uint32_t i = 0; i < iters; i++)
+                memcpy(dst, src, size);
+            break;
+        case BENCH_MEMCPY_BYTEWISE:
+            for (uint32_t i = 0; i < iters; i++)
+                bytewise_memcpy(dst, src, size);
+            break;
+        case BENCH_MEMSET:
+            for (uint32_t i = 0; i < iters; i++)
+                memset(dst, i, size);
+            break;
+        case BENCH_STRLEN:
+            for (uint32_t i = 0; i < iters; i++)
+                sink += strlen((char *) src);
+            break;
+        case BENCH_STRCMP:
+            for (uint32_t i = 0; i < iters; i++)
+                sink += strcmp((char *) dst, (char *) src);
+            break;
+    }
+    return rdcycle() - start;
+}
+
+static void bench_row(const char *name, int op, uint32_t size, uint32_t dst_off,
+                      uint32_t src_off) {
+    uint32_t iters = BENCH_BYTES / size;
+    uint8_t *dst = bench_dst + dst_off;
+    uint8_t *src = bench_src + src_off;
+
+    // 字串測試用：兩邊都是 size - 1 個相同字元加上結尾
+    memset(bench_src, 'a', sizeof(bench_src));
+    memset(bench_dst, 'a', sizeof(bench_dst));
+    src[size - 1] = '\0';
+    dst[size - 1] = '\0';
+
+    printf("%s size=%d dst+%d src+%d:", name, size, dst_off, src_off);
+    print_rate(iters * size, bench_run(op, dst, src, size, iters));
+    if (op == BENCH_MEMCPY) {
+        printf(" (bytewise");
+        print_rate(iters * size, bench_run(BENCH_MEMCPY_BYTEWISE, dst, src, size, iters));
+        printf(")");
+    }
+    printf(" bytes/cycle\n");
+}
+
+// 陷入核心的成本：同樣的操作逐一 syscall 與整批經由提交環各做一次，印出每個操作的週期數
+#define RING_BENCH_NOPS  URING_ENTRIES
+#define RING_BENCH_READS 16
+#define RING_BENCH_SECTOR 512 // 與核心的 SECTOR_SIZE 相同
+
+static uint8_t ring_bench_buf[RING_BENCH_READS * RING_BENCH_SECTOR];
+
+static void ring_bench_drain(struct uring *r) {
+    struct uring_cqe cqe;
+    while (uring_reap(r, &cqe))
+        ;
+}
+
+static void ring_bench_row(const char *name, uint32_t ops, uint32_t syscall_cycles,
+                           uint32_t ring_cycles) {
+    printf("%s x%d: syscall %d cycles/op, ring %d cycles/op\n", name, ops,
+           syscall_cycles / ops, ring_cycles / ops);
+}
+
+// shell 的 bench ring 命令
+void ring_bench_main(void) {
+    struct uring *r = uring_setup(0);
+
+    // 空的 enter 就是一次單純的陷入與返回
+    uint32_t start = rdcycle();
+    for (int i = 0; i < RING_BENCH_NOPS; i++)
+        uring_enter();
+    uint32_t syscall_cycles = rdcycle() - start;
+    start = rdcycle();
+    for (int i = 0; i < RING_BENCH_NOPS; i++)
+        uring_prep(r, URING_OP_NOP, NULL, 0, 0, i);
+    uring_enter();
+    ring_bench_drain(r);
+    ring_bench_row("nop", RING_BENCH_NOPS, syscall_cycles, rdcycle() - start);
+
+    start = rdcycle();
+    for (int i = 0; i < RING_BENCH_READS; i++) {
+        uint8_t *buf = ring_bench_buf + i * RING_BENCH_SECTOR;
+        syscall(SYS_DISK_READ, (int) buf, DISK_SCRATCH_SECTOR + i, RING_BENCH_SECTOR);
+    }
+    syscall_cycles = rdcycle() - start;
+    start = rdcycle();
+    for (int i = 0; i < RING_BENCH_READS; i++) {
+        uint8_t *buf = ring_bench_buf + i * RING_BENCH_SECTOR;
+        uring_prep(r, URING_OP_DISK_READ, buf, RING_BENCH_SECTOR, DISK_SCRATCH_SECTOR + i, i);
+    }
+    uring_enter();
+    ring_bench_drain(r);
+    ring_bench_row("disk read", RING_BENCH_READS, syscall_cycles, rdcycle() - start);
+}
+
+// shell 的 bench 命令
+void bench_main(void) {
+    for (uint32_t i = 0; i < BENCH_NSIZES; i++) {
+        uint32_t size = bench_sizes[i];
+        bench_row("memcpy", BENCH_MEMCPY, size, 0, 0); // 都對齊
+        bench_row("memcpy", BENCH_MEMCPY, size, 1, 1); // 同樣的不對齊
+        bench_row("memcpy", BENCH_MEMCPY, size, 0, 3); // 相對不對齊
+        bench_row("memset", BENCH_MEMSET, size, 0, 0);
+        bench_row("memset", BENCH_MEMSET, size, 3, 0);
+        bench_row("strlen", BENCH_STRLEN, size, 0, 0);
+        bench_row("strlen", BENCH_STRLEN, size, 0, 1);
+        bench_row("strcmp", BENCH_STRCMP, size, 0, 0);
+        bench_row("strcmp", BENCH_STRCMP, size, 2, 1);
+    }
+}
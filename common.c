@@ -1,7 +1,36 @@
 #include "common.h"
 
+// 以 32 位元字組處理記憶體與字串。rv32imac 不支援（或極慢地模擬）非對齊的
+// lw/sw，所以只對齊後的部分用字組存取，頭尾剩下的位元組逐一處理。
+// may_alias：讓編譯器知道這些字組存取可能與任何型別的資料重疊。
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+#define WORD_SIZE  sizeof(word_t)
+#define WORD_MASK  (WORD_SIZE - 1)
+#define ONES       0x01010101u
+#define HIGHS      0x80808080u
+// 字組中是否有 0 位元組
+#define HAS_ZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
 void *memset(void *buf, char c, size_t n) {
     uint8_t *p = (uint8_t *) buf;
+    while (n > 0 && ((uint32_t) p & WORD_MASK)) {
+        *p++ = c;
+        n--;
+    }
+
+    word_t w = (uint8_t) c * ONES;
+    word_t *wp = (word_t *) p;
+    for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, wp += 4) {
+        wp[0] = w;
+        wp[1] = w;
+        wp[2] = w;
+        wp[3] = w;
+    }
+    for (; n >= WORD_SIZE; n -= WORD_SIZE)
+        *wp++ = w;
+
+    p = (uint8_t *) wp;
     while (n--)
         *p++ = c;
     return buf;
@@ -10,13 +39,59 @@ void *memset(void *buf, char c, size_t n) {
 void *memcpy(void *dst, const void *src, size_t n) {
     uint8_t *d = (uint8_t *) dst;
     const uint8_t *s = (const uint8_t *) src;
+    while (n > 0 && ((uint32_t) d & WORD_MASK)) {
+        *d++ = *s++;
+        n--;
+    }
+
+    word_t *wd = (word_t *) d;
+    uint32_t shift = ((uint32_t) s & WORD_MASK) * 8;
+    if (shift == 0) {
+        const word_t *ws = (const word_t *) s;
+        for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, wd += 4, ws += 4) {
+            wd[0] = ws[0];
+            wd[1] = ws[1];
+            wd[2] = ws[2];
+            wd[3] = ws[3];
+        }
+        for (; n >= WORD_SIZE; n -= WORD_SIZE)
+            *wd++ = *ws++;
+        s = (const uint8_t *) ws;
+    } else if (n >= 2 * WORD_SIZE) {
+        // 來源與目的相對不對齊：只讀對齊的來源字組，以移位拼出目的字組（little endian）。
+        // 保留一個字組不在迴圈裡處理，避免讀到來源結尾之後的下一個字組。
+        const word_t *ws = (const word_t *) ((uint32_t) s & ~WORD_MASK);
+        word_t prev = *ws++;
+        for (; n >= 2 * WORD_SIZE; n -= WORD_SIZE) {
+            word_t next = *ws++;
+            *wd++ = (prev >> shift) | (next << (32 - shift));
+            prev = next;
+        }
+        s = (const uint8_t *) ws - WORD_SIZE + shift / 8;
+    }
+
+    d = (uint8_t *) wd;
     while (n--)
         *d++ = *s++;
     return dst;
 }
 
+// 來源與目的對齊方式相同時，整個字組沒有結尾的 0 才一次複製
 char *strcpy(char *dst, const char *src) {
     char *d = dst;
+    if ((((uint32_t) d ^ (uint32_t) src) & WORD_MASK) == 0) {
+        while ((uint32_t) src & WORD_MASK) {
+            if ((*d++ = *src++) == '\0')
+                return dst;
+        }
+        word_t *wd = (word_t *) d;
+        const word_t *ws = (const word_t *) src;
+        while (!HAS_ZERO(*ws))
+            *wd++ = *ws++;
+        d = (char *) wd;
+        src = (const char *) ws;
+    }
+
     while (*src)
         *d++ = *src++;
     *d = '\0';
@@ -24,6 +99,24 @@ char *strcpy(char *dst, const char *src) {
 }
 
 int strcmp(const char *s1, const char *s2) {
+    // 對齊方式相同時逐字組比較，遇到不同或含 0 的字組再交給逐位元組比較
+    if ((((uint32_t) s1 ^ (uint32_t) s2) & WORD_MASK) == 0) {
+        while ((uint32_t) s1 & WORD_MASK) {
+            if (*s1 == '\0' || *s1 != *s2)
+                return *(unsigned char *)s1 - *(unsigned char *)s2;
+            s1++;
+            s2++;
+        }
+        const word_t *w1 = (const word_t *) s1;
+        const word_t *w2 = (const word_t *) s2;
+        while (*w1 == *w2 && !HAS_ZERO(*w1)) {
+            w1++;
+            w2++;
+        }
+        s1 = (const char *) w1;
+        s2 = (const char *) w2;
+    }
+
     while (*s1 && *s2) {
         if (*s1 != *s2)
             break;
@@ -34,8 +127,19 @@ int strcmp(const char *s1, const char *s2) {
     return *(unsigned char *)s1 - *(unsigned char *)s2;
 }
 
+// 對齊的字組讀取不會跨頁，所以讀到結尾 0 之後的幾個位元組是安全的
 size_t strlen(const char *s) {
     const char *p = s;
+    while ((uint32_t) p & WORD_MASK) {
+        if (*p == '\0')
+            return p - s;
+        p++;
+    }
+
+    const word_t *w = (const word_t *) p;
+    while (!HAS_ZERO(*w))
+        w++;
+    p = (const char *) w;
     while (*p) p++;
     return p - s;
 }
@@ -57,12 +161,66 @@ char *strstr(const char *haystack, const char *needle) {
 
 void putchar(char ch);
 
+#define FMT_LEFT 1 // '-'：靠左對齊
+#define FMT_ZERO 2 // '0'：數字前補 0
+
+static void print_pad(char c, int n) {
+    while (n-- > 0)
+        putchar(c);
+}
+
+static void print_string(const char *s, int width, int flags) {
+    int len = strlen(s);
+    if (!(flags & FMT_LEFT))
+        print_pad(' ', width - len);
+    while (*s)
+        putchar(*s++);
+    if (flags & FMT_LEFT)
+        print_pad(' ', width - len);
+}
+
+static void print_number(uint32_t value, uint32_t base, bool negative, int width,
+                         int flags) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value);
+
+    int len = n + (negative ? 1 : 0);
+    if (!(flags & (FMT_LEFT | FMT_ZERO)))
+        print_pad(' ', width - len);
+    if (negative)
+        putchar('-');
+    if ((flags & FMT_ZERO) && !(flags & FMT_LEFT))
+        print_pad('0', width - len);
+    while (n > 0)
+        putchar(digits[--n]);
+    if (flags & FMT_LEFT)
+        print_pad(' ', width - len);
+}
+
+// 支援 %d %u %x %p %s %c %%，以及 '-'、'0' 旗標與欄寬（例如 %08x、%-10s）
 void printf(const char *fmt, ...) {
     va_list vargs;
     va_start(vargs, fmt);
     while (*fmt) {
         if (*fmt == '%') {
             fmt++;
+            int flags = 0;
+            for (;; fmt++) {
+                if (*fmt == '-')
+                    flags |= FMT_LEFT;
+                else if (*fmt == '0')
+                    flags |= FMT_ZERO;
+                else
+                    break;
+            }
+            int width = 0;
+            while (*fmt >= '0' && *fmt <= '9')
+                width = width * 10 + (*fmt++ - '0');
+
             switch (*fmt) {
                 case '\0':
                     putchar('%');
@@ -70,40 +228,32 @@ void printf(const char *fmt, ...) {
                 case '%':
                     putchar('%');
                     break;
-                case 's': {
-                    const char *s = va_arg(vargs, const char *);
-                    while (*s) {
-                        putchar(*s);
-                        s++;
-                    }
+                case 's':
+                    print_string(va_arg(vargs, const char *), width, flags);
+                    break;
+                case 'c': {
+                    char buf[2] = { (char) va_arg(vargs, int), '\0' };
+                    print_string(buf, width, flags);
                     break;
                 }
                 case 'd': {
                     int value = va_arg(vargs, int);
-                    if (value < 0) {
-                        putchar('-');
-                        value = -value;
-                    }
-
-                    int divisor = 1;
-                    while (value / divisor > 9)
-                        divisor *= 10;
-
-                    while (divisor > 0) {
-                        putchar('0' + value / divisor);
-                        value %= divisor;
-                        divisor /= 10;
-                    }
-
+                    // 轉成 uint32_t 再取負，INT_MIN 也不會溢位
+                    uint32_t magnitude = value < 0 ? -(uint32_t) value : (uint32_t) value;
+                    print_number(magnitude, 10, value < 0, width, flags);
                     break;
                 }
-                case 'x': {
-                    int value = va_arg(vargs, int);
-                    for (int i = 7; i >= 0; i--) {
-                        int nibble = (value >> (i * 4)) & 0xf;
-                        putchar("0123456789abcdef"[nibble]);
-                    }
-                }
+                case 'u':
+                    print_number(va_arg(vargs, uint32_t), 10, false, width, flags);
+                    break;
+                case 'x':
+                    print_number(va_arg(vargs, uint32_t), 16, false, width, flags);
+                    break;
+                case 'p':
+                    putchar('0');
+                    putchar('x');
+                    print_number(va_arg(vargs, uint32_t), 16, false, 8, FMT_ZERO);
+                    break;
             }
         } else {
             putchar(*fmt);
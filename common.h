@@ -15,17 +15,47 @@
 #define SYS_GETCHAR 2
 #define SYS_EXIT    3
 #define SYS_GETCHAR_NONBLOCK 100
+#define SYS_SYNC             101
+#define SYS_BCACHE_STATS     102
+#define SYS_DISK_READ        103
+#define SYS_DISK_WRITE       104
+#define SYS_MEM_STATS        105
+#define SYS_SPAWN            106
+#define SYS_WAIT             107
+#define SYS_PROC_STATS       108
+#define SYS_SET_TIME_SLICE   109
+#define SYS_CPU_STATS        110
+#define SYS_URING_SETUP      111
+#define SYS_URING_ENTER      112
+#define SYS_OPEN             113
+#define SYS_READ             114
+#define SYS_WRITE            115
+#define SYS_CLOSE            116
+#define SYS_LIST             117
+
+// SYS_DISK_READ/SYS_DISK_WRITE 與 URING_OP_DISK_* 不能碰 LLM 請求環與檔案系統。
+// 兩者之間的這段磁區保留給使用者自由讀寫（磁碟在檔案系統之後若還有空間也可以）。
+#define DISK_SCRATCH_SECTOR  584
+#define DISK_SCRATCH_SECTORS 56
 
 // LLM 相關常數
-#define LLM_REQUEST_FILE  0
-#define LLM_RESPONSE_FILE 1
-#define LLM_STATUS_FILE   2
-#define LLM_MAX_MSG_SIZE  512
+// 請求/回應緩衝區的大小（含結尾的 NUL），使用者的緩衝區至少要這麼大。
+// 加上 16 位元組的訊框 header 剛好是整數個磁區。
+#define LLM_MAX_REQUEST_SIZE  4080
+#define LLM_MAX_RESPONSE_SIZE 32752
 
 // LLM 系統呼叫號碼
 #define SYS_LLM_SEND_REQUEST  200
 #define SYS_LLM_GET_RESPONSE  201
 #define SYS_LLM_SIMULATE      202
+#define SYS_LLM_STREAM        203
+#define SYS_LLM_CACHE_STATS   204
+#define SYS_LLM_CACHE_TTL     205
+#define SYS_LLM_WAIT          206
+#define SYS_LLM_CANCEL        207
+
+// SYS_LLM_STREAM 的回傳值：回應已完整且全部取回，槽位已釋放
+#define LLM_STREAM_DONE (-2)
 
 typedef int bool;
 typedef unsigned char uint8_t;
@@ -36,6 +66,101 @@ typedef uint32_t size_t;
 typedef uint32_t paddr_t;
 typedef uint32_t vaddr_t;
 
+// SYS_OPEN 的 flags
+#define O_CREAT 1 // 檔案不存在時建立
+#define O_TRUNC 2 // 開啟時把內容清空
+
+// SYS_LIST 回傳的檔案清單項目
+#define FS_NAME_MAX 56 // 檔名含結尾的 NUL
+struct fs_dirent {
+    char name[FS_NAME_MAX];
+    uint32_t size;
+};
+
+// SYS_BCACHE_STATS 回傳的磁區快取統計
+struct bcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;
+};
+
+// SYS_LLM_CACHE_STATS 回傳的 LLM 回應快取統計
+struct llm_cache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t insertions;
+    uint32_t evictions; // 為了騰出空間而淘汰
+    uint32_t expired;   // 超過 TTL 而丟掉
+    uint32_t entries;
+    uint32_t pages;     // 目前佔用的頁數
+    uint32_t ttl;       // 秒，0 表示不過期
+};
+
+// SYS_URING_SETUP 映射進進程的提交/完成環（一頁，使用者與核心共用）。
+// 使用者填好 sq[sq_tail % URING_ENTRIES] 再增加 sq_tail；核心取走後增加 sq_head，
+// 結果放進 cq[cq_tail % URING_ENTRIES] 再增加 cq_tail；使用者讀完增加 cq_head。
+// 完成環滿了核心就停下，所以不會覆蓋還沒讀的結果。
+#define URING_ENTRIES      64
+#define URING_SETUP_SQPOLL 1 // 核心在這個進程每次被中斷時順便處理提交環，不必 enter
+
+#define URING_OP_NOP           0
+#define URING_OP_DISK_READ     1 // addr 為緩衝區、len 為位元組數（磁區的倍數）、arg 為磁區；結果 0 或 -1
+#define URING_OP_DISK_WRITE    2
+#define URING_OP_CONSOLE_WRITE 3 // 輸出 addr 開始的 len 個位元組；結果為 len，位址無效時為 -1
+#define URING_OP_LLM_SEND      4 // 同 SYS_LLM_SEND_REQUEST，addr 為請求；結果為請求 ID
+#define URING_OP_LLM_POLL      5 // 同 SYS_LLM_GET_RESPONSE，addr 為緩衝區、arg 為請求 ID
+#define URING_OP_LLM_STREAM    6 // 同 SYS_LLM_STREAM，addr 為緩衝區、arg 為請求 ID、len 為 offset
+
+struct uring_sqe {
+    uint32_t opcode;
+    uint32_t addr;
+    uint32_t len;
+    uint32_t arg;
+    uint32_t user_data; // 原封不動放進對應的 cqe
+};
+
+struct uring_cqe {
+    uint32_t user_data;
+    int result;         // 不認得的 opcode 為 -1
+};
+
+struct uring {
+    volatile uint32_t sq_head; // 核心寫
+    volatile uint32_t sq_tail; // 使用者寫
+    volatile uint32_t cq_head; // 使用者寫
+    volatile uint32_t cq_tail; // 核心寫
+    struct uring_sqe sq[URING_ENTRIES];
+    struct uring_cqe cq[URING_ENTRIES];
+};
+
+// SYS_PROC_STATS 回傳的進程統計
+struct proc_stats {
+    uint32_t live;    // 執行中或等待中
+    uint32_t zombie;  // 已結束、尚未被回收
+    uint32_t created;
+    uint32_t reaped;
+};
+
+// SYS_CPU_STATS 回傳的每個 hart 使用率
+#define CPUS_MAX 8
+struct cpu_stats {
+    uint32_t hartid;
+    uint32_t busy_percent;     // 上線以來不在 idle wfi 中的時間比例
+    uint32_t context_switches;
+    int pid;                   // 目前執行的進程，-1 為 idle
+};
+
+// SYS_MEM_STATS 回傳的實體頁面配置統計（單位：頁）
+#define BUDDY_MAX_ORDER 10
+struct mm_stats {
+    uint32_t total_pages;
+    uint32_t free_pages;
+    uint32_t largest_free_block;
+    uint32_t fragmentation; // 百分比
+    uint32_t free_blocks[BUDDY_MAX_ORDER + 1];
+};
+
 void *memset(void *buf, char c, size_t n);
 void *memcpy(void *dst, const void *src, size_t n);
 char *strcpy(char *dst, const char *src);
@@ -0,0 +1,142 @@
+#include "kernel.h"
+#include "common.h"
+
+// 核心主控台輸出：putchar 只寫進環狀緩衝區，遇到換行或緩衝區滿才用
+// SBI Debug Console（DBCN）一次送出整段，一行只要一次 M-mode 往返。
+// 沒有 DBCN 的 SBI 實作退回逐字元的 legacy console putchar。
+#define CONSOLE_BUF_SIZE 256 // 2 的冪次，索引直接取餘數
+
+static char console_buf[CONSOLE_BUF_SIZE];
+static uint32_t console_head; // 下一個寫入位置（累加，不回繞）
+static uint32_t console_tail; // 下一個要送出的位置
+static struct spinlock console_lock;
+static int dbcn_state;        // 0：尚未偵測，1：可用，-1：不可用
+static bool console_panicked; // PANIC 之後不經過緩衝區與 console_lock，直接送出
+
+static void console_write(const char *s, uint32_t len) {
+    if (dbcn_state == 0) {
+        struct sbiret ret = sbi_call(SBI_EXT_DBCN, 0, 0, 0, 0, 0,
+                                     3 /* probe_extension */, SBI_EXT_BASE);
+        dbcn_state = ret.error == 0 && ret.value ? 1 : -1;
+    }
+
+    // 核心為恆等映射，緩衝區的位址就是 DBCN 要的實體位址；可能只寫出一部分
+    while (len > 0 && dbcn_state > 0) {
+        struct sbiret ret = sbi_call(len, (long) s, 0, 0, 0, 0,
+                                     0 /* console_write */, SBI_EXT_DBCN);
+        if (ret.error) {
+            dbcn_state = -1;
+            break;
+        }
+        s += ret.value;
+        len -= ret.value;
+    }
+
+    while (len-- > 0)
+        sbi_call(*s++, 0, 0, 0, 0, 0, 0, 1 /* Console Putchar */);
+}
+
+static void console_flush_locked(void) {
+    while (console_tail != console_head) {
+        uint32_t start = console_tail % CONSOLE_BUF_SIZE;
+        uint32_t len = console_head - console_tail;
+        if (len > CONSOLE_BUF_SIZE - start)
+            len = CONSOLE_BUF_SIZE - start; // 先送到緩衝區結尾，回繞的部分下一輪
+        console_write(&console_buf[start], len);
+        console_tail += len;
+    }
+}
+
+// 送出緩衝區中的所有內容。沒有換行的輸出（例如提示字元）由 idle、
+// 計時器中斷與讀取鍵盤前的呼叫送出。
+void console_flush(void) {
+    spin_lock(&console_lock);
+    console_flush_locked();
+    spin_unlock(&console_lock);
+}
+
+// PANIC 時呼叫：不上鎖送出緩衝區剩下的內容，之後的輸出也不再上鎖。出錯的
+// hart 可能正持有 console_lock（甚至就是在它上面自我死結），上鎖會無聲地卡住。
+void console_panic(void) {
+    console_panicked = true;
+    console_flush_locked();
+}
+
+void putchar(char ch) {
+    if (console_panicked) {
+        console_write(&ch, 1);
+        return;
+    }
+    spin_lock(&console_lock);
+    if (console_head - console_tail == CONSOLE_BUF_SIZE)
+        console_flush_locked();
+    console_buf[console_head++ % CONSOLE_BUF_SIZE] = ch;
+    if (ch == '\n')
+        console_flush_locked();
+    spin_unlock(&console_lock);
+}
+
+// 鍵盤輸入：UART 收到資料時發出中斷，中斷處理把 FIFO 清進接收緩衝區並喚醒讀者。
+// 緩衝區滿時關掉 RX 中斷，資料留在 UART 的 FIFO 裡，讀者取走一半後再打開，
+// 一次貼上大量文字也不會在核心這一層被丟掉。
+#define CONSOLE_RX_SIZE 1024 // 2 的冪次
+
+static char console_rx[CONSOLE_RX_SIZE];
+static uint32_t rx_head; // 中斷處理寫入的位置
+static uint32_t rx_tail; // 讀者讀取的位置
+static bool rx_throttled;
+static struct spinlock rx_lock;
+static struct wait_queue console_wait_queue;
+
+static volatile uint8_t *uart_reg(unsigned offset) {
+    return (volatile uint8_t *) (UART_BASE + offset);
+}
+
+void uart_init(void) {
+    *uart_reg(UART_FCR) = UART_FCR_FIFO;
+    *uart_reg(UART_MCR) |= UART_MCR_OUT2;
+    *uart_reg(UART_IER) = UART_IER_RX;
+}
+
+// 呼叫者持有 rx_lock
+static void uart_drain_locked(void) {
+    while (rx_head - rx_tail < CONSOLE_RX_SIZE && (*uart_reg(UART_LSR) & UART_LSR_DR))
+        console_rx[rx_head++ % CONSOLE_RX_SIZE] = *uart_reg(UART_RHR);
+
+    if (rx_head - rx_tail == CONSOLE_RX_SIZE && !rx_throttled) {
+        rx_throttled = true;
+        *uart_reg(UART_IER) = 0;
+    }
+}
+
+void uart_handle_irq(void) {
+    spin_lock(&rx_lock);
+    uart_drain_locked();
+    if (rx_head != rx_tail)
+        wake_up(&console_wait_queue);
+    spin_unlock(&rx_lock);
+}
+
+// 取出一個輸入字元；block 為 false 且沒有輸入時回傳 -1
+int console_getc(bool block) {
+    spin_lock(&rx_lock);
+    while (rx_head == rx_tail) {
+        if (!block) {
+            spin_unlock(&rx_lock);
+            return -1;
+        }
+        console_flush(); // 提示字元沒有換行，等輸入前先送出
+        sleep_on(&console_wait_queue, &rx_lock);
+    }
+
+    int ch = (uint8_t) console_rx[rx_tail++ % CONSOLE_RX_SIZE];
+    if (rx_throttled && rx_head - rx_tail <= CONSOLE_RX_SIZE / 2) {
+        // 先把 FIFO 裡累積的資料收進來，再重新打開中斷
+        rx_throttled = false;
+        uart_drain_locked();
+        if (!rx_throttled)
+            *uart_reg(UART_IER) = UART_IER_RX;
+    }
+    spin_unlock(&rx_lock);
+    return ch;
+}
@@ -0,0 +1,504 @@
+#include "kernel.h"
+#include "common.h"
+#include "bcache.h"
+#include "fs.h"
+#include "llm.h"
+
+// bitmap 與 inode 表在磁碟上相連，記憶體中也放在同一段 meta 裡：寫回時
+// 把變動的區塊範圍以一個多磁區請求寫出。files[i] 對應 inode i，另外以
+// 檔名的 FNV-1a 雜湊建索引，開檔的成本與檔案數無關。
+static struct fs_superblock sb;
+static uint8_t *meta;           // 磁碟上從 bitmap_start 到 data_start 的內容
+static uint8_t *meta_copy;      // 寫回時的快照，寫磁碟期間 meta 可以繼續改
+static uint32_t meta_blocks;
+static uint8_t *bitmap;         // 第 i 個位元為 1 表示區塊 i 已使用
+static struct fs_inode *inodes;
+static struct file files[FILES_MAX];
+static int buckets[FS_NBUCKET]; // files[] 的索引，-1 表示空
+static uint32_t alloc_rotor;    // 下次從這個區塊開始找空區塊
+static uint32_t free_blocks;
+static bool fs_ready;
+// meta 中還沒寫回的區塊範圍 [dirty_lo, dirty_hi)，兩者相等表示沒有
+static uint32_t dirty_lo, dirty_hi;
+static bool flushing;                // 有人正在把 meta_copy 寫到磁碟
+static struct wait_queue flush_wait; // 等 flushing 結束
+static struct wait_queue file_wait;  // 等某個檔案的 busy 結束
+// 保護上面全部（meta_copy 除外）與 inode 的內容；磁碟 I/O 期間不持有
+static struct spinlock fs_lock;
+
+#define BLOCK_SECTOR(block) (FS_BASE_SECTOR + (block) * FS_BLOCK_SECTORS)
+
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    while (*name)
+        h = (h ^ (uint8_t) *name++) * 16777619u;
+    return h;
+}
+
+// 呼叫者持有 fs_lock（開機時不需要）
+static struct file *fs_lookup(const char *name) {
+    int i = buckets[name_hash(name) % FS_NBUCKET];
+    while (i >= 0 && strcmp(files[i].inode->name, name) != 0)
+        i = files[i].hash_next;
+    return i >= 0 ? &files[i] : NULL;
+}
+
+static void hash_insert(int i) {
+    int *bucket = &buckets[name_hash(inodes[i].name) % FS_NBUCKET];
+    files[i].hash_next = *bucket;
+    *bucket = i;
+}
+
+// 把 meta 中 [lo, hi) 個區塊併入待寫回的範圍
+static void dirty_range(uint32_t lo, uint32_t hi) {
+    if (dirty_lo == dirty_hi) {
+        dirty_lo = lo;
+        dirty_hi = hi;
+        return;
+    }
+    if (lo < dirty_lo)
+        dirty_lo = lo;
+    if (hi > dirty_hi)
+        dirty_hi = hi;
+}
+
+static void inode_dirty(struct fs_inode *inode) {
+    uint32_t block = sb.bitmap_blocks
+                     + (uint32_t) ((uint8_t *) inode - (uint8_t *) inodes) / FS_BLOCK_SIZE;
+    dirty_range(block, block + 1);
+}
+
+static bool block_used(uint32_t block) {
+    return bitmap[block / 8] & (1 << (block % 8));
+}
+
+static void mark_blocks(uint32_t start, uint32_t len, bool used) {
+    if (len == 0)
+        return;
+    for (uint32_t b = start; b < start + len; b++) {
+        if (used)
+            bitmap[b / 8] |= 1 << (b % 8);
+        else
+            bitmap[b / 8] &= ~(1 << (b % 8));
+    }
+    free_blocks = used ? free_blocks - len : free_blocks + len;
+    dirty_range((start / 8) / FS_BLOCK_SIZE, ((start + len - 1) / 8) / FS_BLOCK_SIZE + 1);
+}
+
+// 從 from 往後找第一個空的區塊，一次跳過 32 個都已使用的區塊；找不到回傳 0
+static uint32_t find_free(uint32_t from, uint32_t to) {
+    uint32_t b = from;
+    while (b < to) {
+        if (b % 32 == 0 && b + 32 <= to && ((uint32_t *) bitmap)[b / 32] == 0xffffffff) {
+            b += 32;
+            continue;
+        }
+        if (!block_used(b))
+            return b;
+        b++;
+    }
+    return 0;
+}
+
+// 配置最多 want 個連續區塊，盡量從 goal 開始（延伸檔案的最後一段）；否則從
+// alloc_rotor 往後找第一個空區塊。rotor 只往前走，到尾端才繞回來，循序配置時
+// 每個區塊只會被掃過一次。回傳配置到的數量，磁碟滿了回傳 0。
+// 呼叫者持有 fs_lock。
+static uint32_t balloc(uint32_t goal, uint32_t want, uint32_t *start) {
+    uint32_t b = goal;
+    if (b < sb.data_start || b >= sb.nblocks || block_used(b)) {
+        b = find_free(alloc_rotor, sb.nblocks);
+        if (!b)
+            b = find_free(sb.data_start, alloc_rotor);
+        if (!b)
+            return 0;
+    }
+
+    uint32_t n = 0;
+    while (n < want && b + n < sb.nblocks && !block_used(b + n))
+        n++;
+    mark_blocks(b, n, true);
+    alloc_rotor = b + n < sb.nblocks ? b + n : sb.data_start;
+    *start = b;
+    return n;
+}
+
+// 釋放檔案的所有區塊。呼叫者持有 fs_lock
+static void inode_truncate(struct fs_inode *inode) {
+    for (int i = 0; i < inode->nextents; i++)
+        mark_blocks(inode->extents[i].start, inode->extents[i].len, false);
+    inode->nextents = 0;
+    inode->size = 0;
+    inode_dirty(inode);
+}
+
+// 讓檔案至少有 blocks 個區塊，能接在最後一段後面就延伸它。回傳實際的區塊數
+// （磁碟滿了或 extent 用完時會比較少）。呼叫者持有 fs_lock。
+static uint32_t inode_grow(struct fs_inode *inode, uint32_t blocks) {
+    uint32_t have = 0;
+    for (int i = 0; i < inode->nextents; i++)
+        have += inode->extents[i].len;
+
+    while (have < blocks) {
+        struct fs_extent *last = inode->nextents ? &inode->extents[inode->nextents - 1] : NULL;
+        uint32_t start;
+        uint32_t n = balloc(last ? last->start + last->len : 0, blocks - have, &start);
+        if (n == 0)
+            break;
+        if (last && start == last->start + last->len) {
+            last->len += n;
+        } else if (inode->nextents < FS_EXTENTS) {
+            inode->extents[inode->nextents].start = start;
+            inode->extents[inode->nextents].len = n;
+            inode->nextents++;
+        } else {
+            mark_blocks(start, n, false);
+            break;
+        }
+        have += n;
+        inode_dirty(inode);
+    }
+    return have;
+}
+
+// 檢查磁碟上的 inode：extent 都要落在資料區內、不能是空的，大小不能超過
+// 配置的區塊。不合格的 inode 不掛上來，免得讀寫到檔案系統以外的磁區。
+static bool inode_valid(const struct fs_inode *inode) {
+    if (inode->nextents > FS_EXTENTS)
+        return false;
+    uint64_t blocks = 0;
+    for (int i = 0; i < inode->nextents; i++) {
+        const struct fs_extent *e = &inode->extents[i];
+        if (e->len == 0 || e->start < sb.data_start || e->start >= sb.nblocks
+            || e->len > sb.nblocks - e->start)
+            return false;
+        blocks += e->len;
+    }
+    return inode->size <= blocks * FS_BLOCK_SIZE;
+}
+
+void fs_init(void) {
+    if (FS_BASE_SECTOR < LLM_REQ_SECTOR(LLM_RING_SLOTS))
+        PANIC("file system overlaps the LLM request ring");
+    if (DISK_SCRATCH_SECTOR < LLM_REQ_SECTOR(LLM_RING_SLOTS)
+        || DISK_SCRATCH_SECTOR + DISK_SCRATCH_SECTORS > FS_BASE_SECTOR)
+        PANIC("disk scratch area overlaps the LLM ring or the file system");
+
+    for (int i = 0; i < FS_NBUCKET; i++)
+        buckets[i] = -1;
+    unsigned disk_sectors = blk_capacity / SECTOR_SIZE;
+    if (disk_sectors < BLOCK_SECTOR(1)) {
+        printf("fs: no file system on disk (run mkfs.py)\n");
+        return;
+    }
+
+    struct fs_superblock *super = (struct fs_superblock *) alloc_pages(1);
+    if (blk_read(FS_BASE_SECTOR, super, FS_BLOCK_SIZE) < 0)
+        PANIC("fs: failed to read the superblock");
+    sb = *super;
+    free_pages((paddr_t) super, 1);
+    // 先確定 nblocks 放得進磁碟，之後的計算就不會溢位；bitmap 與 inode 表的
+    // 大小必須剛好是 mkfs.py 算出來的，metadata 因此不會大得離譜
+    if (sb.magic != FS_MAGIC || sb.block_size != FS_BLOCK_SIZE || sb.ninodes > FILES_MAX
+        || sb.nblocks > (disk_sectors - FS_BASE_SECTOR) / FS_BLOCK_SECTORS
+        || sb.bitmap_blocks != align_up(sb.nblocks, FS_BLOCK_SIZE * 8) / (FS_BLOCK_SIZE * 8)
+        || sb.inode_blocks
+               != align_up(sb.ninodes * sizeof(struct fs_inode), FS_BLOCK_SIZE) / FS_BLOCK_SIZE
+        || sb.bitmap_start != 1 || sb.inode_start != sb.bitmap_start + sb.bitmap_blocks
+        || sb.bitmap_blocks + sb.inode_blocks > FS_META_MAX_BLOCKS
+        || sb.data_start != sb.inode_start + sb.inode_blocks || sb.data_start >= sb.nblocks) {
+        printf("fs: no valid file system on disk (run mkfs.py)\n");
+        return;
+    }
+
+    meta_blocks = sb.data_start - sb.bitmap_start;
+    meta = (uint8_t *) alloc_pages(meta_blocks);
+    meta_copy = (uint8_t *) alloc_pages(meta_blocks);
+    if (blk_read(BLOCK_SECTOR(sb.bitmap_start), meta, meta_blocks * FS_BLOCK_SIZE) < 0)
+        PANIC("fs: failed to read the metadata");
+    bitmap = meta;
+    inodes = (struct fs_inode *) (meta + sb.bitmap_blocks * FS_BLOCK_SIZE);
+
+    for (uint32_t b = sb.data_start; b < sb.nblocks; b++) {
+        if (!block_used(b))
+            free_blocks++;
+    }
+    alloc_rotor = sb.data_start;
+
+    for (uint32_t i = 0; i < sb.ninodes; i++) {
+        files[i].inode = &inodes[i];
+        files[i].hash_next = -1;
+        if (!(inodes[i].flags & FS_INODE_USED))
+            continue;
+        if (!inode_valid(&inodes[i])) {
+            printf("fs: skipping corrupt inode %d\n", i);
+            inodes[i].flags = 0;
+            continue;
+        }
+        inodes[i].name[FS_NAME_MAX - 1] = '\0';
+        hash_insert(i);
+        printf("file: %s, size=%d\n", inodes[i].name, inodes[i].size);
+    }
+    printf("fs: %d blocks, %d free\n", sb.nblocks, free_blocks);
+    fs_ready = true;
+}
+
+// 檔案系統結束的磁區（不含）；沒有掛載時為 FS_BASE_SECTOR
+uint32_t fs_end_sector(void) {
+    return fs_ready ? BLOCK_SECTOR(sb.nblocks) : FS_BASE_SECTOR;
+}
+
+// 把 meta 中變動的區塊寫回磁碟，整段一個請求。成功回傳 0。
+// 檔案內容在磁區快取裡的部分由 bcache_flush() 寫回。
+int fs_flush(void) {
+    spin_lock(&fs_lock);
+    while (flushing)
+        sleep_on(&flush_wait, &fs_lock);
+    if (!fs_ready || dirty_lo == dirty_hi) {
+        spin_unlock(&fs_lock);
+        return 0;
+    }
+
+    uint32_t lo = dirty_lo;
+    uint32_t len = (dirty_hi - dirty_lo) * FS_BLOCK_SIZE;
+    memcpy(meta_copy + lo * FS_BLOCK_SIZE, meta + lo * FS_BLOCK_SIZE, len);
+    dirty_lo = dirty_hi = 0; // 寫磁碟期間的修改記到下一次
+    flushing = true;
+    spin_unlock(&fs_lock);
+
+    unsigned sector = BLOCK_SECTOR(sb.bitmap_start + lo);
+    // 與磁區快取保持一致，同 user_disk_rw
+    bcache_sync_range(sector, len / SECTOR_SIZE, false);
+    int ret = blk_write(sector, meta_copy + lo * FS_BLOCK_SIZE, len);
+    bcache_sync_range(sector, len / SECTOR_SIZE, true);
+
+    spin_lock(&fs_lock);
+    if (ret < 0)
+        dirty_range(lo, lo + len / FS_BLOCK_SIZE); // 下次再試
+    flushing = false;
+    wake_up(&flush_wait);
+    spin_unlock(&fs_lock);
+    return ret;
+}
+
+// 取得檔案的使用權，讀寫期間可以睡眠而不持有 fs_lock
+static void file_lock(struct file *file) {
+    spin_lock(&fs_lock);
+    while (file->busy)
+        sleep_on(&file_wait, &fs_lock);
+    file->busy = true;
+    spin_unlock(&fs_lock);
+}
+
+static void file_unlock(struct file *file) {
+    spin_lock(&fs_lock);
+    file->busy = false;
+    wake_up(&file_wait);
+    spin_unlock(&fs_lock);
+}
+
+// 開啟 path，回傳 fd；檔案不存在（且沒有 O_CREAT）或沒有空的 fd 時回傳 -1
+int fs_open(struct process *proc, vaddr_t path, int flags) {
+    char name[FS_NAME_MAX];
+    int n = strnlen_user(path, sizeof(name));
+    if (n <= 0 || n == sizeof(name))
+        return -1;
+    memcpy(name, (const char *) path, n);
+    name[n] = '\0';
+
+    int fd = 0;
+    while (fd < FDS_MAX && proc->fds[fd].file)
+        fd++;
+    if (fd == FDS_MAX)
+        return -1;
+
+    spin_lock(&fs_lock);
+    struct file *file = fs_ready ? fs_lookup(name) : NULL;
+    if (!file && fs_ready && (flags & O_CREAT)) {
+        for (uint32_t i = 0; i < sb.ninodes && !file; i++) {
+            if (inodes[i].flags & FS_INODE_USED)
+                continue;
+            memset(&inodes[i], 0, sizeof(inodes[i]));
+            inodes[i].flags = FS_INODE_USED;
+            strcpy(inodes[i].name, name);
+            inode_dirty(&inodes[i]);
+            hash_insert(i);
+            file = &files[i];
+        }
+    }
+    spin_unlock(&fs_lock);
+
+    if (!file)
+        return -1;
+    if (flags & O_TRUNC) {
+        file_lock(file);
+        spin_lock(&fs_lock);
+        if (file->inode->size > 0 || file->inode->nextents > 0)
+            inode_truncate(file->inode);
+        spin_unlock(&fs_lock);
+        file_unlock(file);
+    }
+    proc->fds[fd].file = file;
+    proc->fds[fd].offset = 0;
+    return fd;
+}
+
+static struct open_file *fd_lookup(struct process *proc, int fd) {
+    if (fd < 0 || fd >= FDS_MAX || !proc->fds[fd].file)
+        return NULL;
+    return &proc->fds[fd];
+}
+
+// 磁碟上從 sector 的第 skip 個位元組開始、連續 len 個位元組與使用者緩衝區之間的
+// 讀寫。完整的磁區以多磁區請求直接 DMA，頭尾不完整的磁區經過磁區快取
+// （寫入只標記為髒，SYS_SYNC 時寫回）。
+static int extent_rw(unsigned sector, uint32_t skip, vaddr_t buf, uint32_t len, bool is_write) {
+    while (len > 0) {
+        if (skip == 0 && len >= SECTOR_SIZE) {
+            uint32_t n = len & ~(SECTOR_SIZE - 1);
+            if (user_disk_rw(buf, sector, n, is_write) < 0)
+                return -1;
+            sector += n / SECTOR_SIZE;
+            buf += n;
+            len -= n;
+            continue;
+        }
+
+        uint32_t n = SECTOR_SIZE - skip < len ? SECTOR_SIZE - skip : len;
+        struct buf *b = bread(sector);
+        if (!b)
+            return -1;
+        if (is_write) {
+            memcpy(b->data + skip, (const void *) buf, n);
+            bdirty(b);
+        } else {
+            memcpy((void *) buf, b->data + skip, n);
+        }
+        brelse(b);
+        sector++;
+        skip = 0;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// 檔案中 [off, off + len) 與使用者緩衝區之間的讀寫，區塊須已配置。
+// 呼叫者持有檔案的 busy，所以 extent 不會被別人改。回傳讀寫的位元組數。
+static int inode_rw(const struct fs_inode *inode, uint32_t off, vaddr_t buf, uint32_t len,
+                    bool is_write) {
+    uint32_t done = 0;
+    uint32_t base = 0; // extents[i] 在檔案中的起點
+    for (int i = 0; i < inode->nextents && done < len; i++) {
+        uint32_t ext_len = inode->extents[i].len * FS_BLOCK_SIZE;
+        uint32_t pos = off + done;
+        if (pos >= base + ext_len) {
+            base += ext_len;
+            continue;
+        }
+        // 同一個 extent 內在磁碟上是連續的，一次處理
+        uint32_t n = base + ext_len - pos < len - done ? base + ext_len - pos : len - done;
+        unsigned sector = BLOCK_SECTOR(inode->extents[i].start) + (pos - base) / SECTOR_SIZE;
+        if (extent_rw(sector, (pos - base) % SECTOR_SIZE, buf + done, n, is_write) < 0)
+            break;
+        done += n;
+        base += ext_len;
+    }
+    return done;
+}
+
+// 從目前位置讀最多 len 個位元組，回傳讀到的數量（檔尾為 0），fd 無效回傳 -1
+int fs_read(struct process *proc, int fd, vaddr_t buf, uint32_t len) {
+    struct open_file *of = fd_lookup(proc, fd);
+    if (!of)
+        return -1;
+
+    struct file *file = of->file;
+    file_lock(file);
+    uint32_t size = file->inode->size;
+    uint32_t n = of->offset < size ? size - of->offset : 0;
+    if (n > len)
+        n = len;
+    n = inode_rw(file->inode, of->offset, buf, n, false);
+    file_unlock(file);
+    of->offset += n;
+    return n;
+}
+
+// 在目前位置寫入（位置超過檔尾時從檔尾開始），需要的區塊先配置好。
+// 回傳寫入的數量，磁碟滿了可能比 len 少；fd 無效回傳 -1。
+int fs_write(struct process *proc, int fd, vaddr_t buf, uint32_t len) {
+    struct open_file *of = fd_lookup(proc, fd);
+    if (!of)
+        return -1;
+
+    struct file *file = of->file;
+    struct fs_inode *inode = file->inode;
+    file_lock(file);
+    spin_lock(&fs_lock);
+    uint32_t off = of->offset < inode->size ? of->offset : inode->size;
+    uint32_t end = off + len < off ? 0xffffffff : off + len;
+    uint64_t have = (uint64_t) inode_grow(inode, align_up((uint64_t) end, FS_BLOCK_SIZE)
+                                                 / FS_BLOCK_SIZE) * FS_BLOCK_SIZE;
+    if (end > have)
+        end = have;
+    spin_unlock(&fs_lock);
+
+    uint32_t n = end > off ? inode_rw(inode, off, buf, end - off, true) : 0;
+
+    spin_lock(&fs_lock);
+    if (off + n > inode->size) {
+        inode->size = off + n;
+        inode_dirty(inode);
+    }
+    spin_unlock(&fs_lock);
+    file_unlock(file);
+    of->offset = off + n;
+    return n;
+}
+
+int fs_close(struct process *proc, int fd) {
+    struct open_file *of = fd_lookup(proc, fd);
+    if (!of)
+        return -1;
+    of->file = NULL;
+    return 0;
+}
+
+// 把最多 max 個檔案的名稱與大小寫進 ents，回傳檔案總數；ents 不是可寫的使用者
+// 記憶體時回傳 -1
+int fs_list(vaddr_t ents, uint32_t max) {
+    if (max > FILES_MAX)
+        max = FILES_MAX;
+    if (!user_range_ok(current_proc->page_table, ents, max * sizeof(struct fs_dirent),
+                       PAGE_U | PAGE_W))
+        return -1;
+
+    // 每次在鎖內抄一小批到核心的緩衝區，放開鎖之後才寫到使用者記憶體
+    struct fs_dirent batch[FS_LIST_BATCH];
+    uint32_t n = 0;
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t first = n;
+        int cnt = 0;
+        spin_lock(&fs_lock);
+        for (; fs_ready && i < sb.ninodes && cnt < FS_LIST_BATCH; i++) {
+            if (!(inodes[i].flags & FS_INODE_USED))
+                continue;
+            if (n < max) {
+                strcpy(batch[cnt].name, inodes[i].name);
+                batch[cnt].size = inodes[i].size;
+                cnt++;
+            }
+            n++;
+        }
+        bool more = fs_ready && i < sb.ninodes;
+        spin_unlock(&fs_lock);
+
+        if (cnt > 0 && copy_to_user(ents + first * sizeof(struct fs_dirent), batch,
+                                    cnt * sizeof(struct fs_dirent)) < 0)
+            return -1;
+        if (!more)
+            return n;
+    }
+}
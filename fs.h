@@ -0,0 +1,60 @@
+#pragma once
+#include "common.h"
+
+// extent 檔案系統，從磁碟的 FS_BASE_SECTOR 開始，由 mkfs.py 建立。
+// 區塊 0 為 superblock，之後依序是 free-block bitmap、inode 表與資料區塊。
+// bitmap 與 inode 表開機時整段讀進記憶體，fs_flush() 才寫回；檔案內容
+// 直接讀寫磁碟（不完整的磁區經過磁區快取）。
+#define FS_MAGIC         0x5346584c // "LXFS"
+#define FS_BLOCK_SIZE    PAGE_SIZE  // 一個區塊剛好一頁
+#define FS_BLOCK_SECTORS (FS_BLOCK_SIZE / SECTOR_SIZE)
+#define FS_EXTENTS       8          // 每個檔案最多幾段連續的區塊
+#define FS_INODE_USED    1
+#define FS_META_MAX_BLOCKS 64       // bitmap 加 inode 表最多幾個區塊（bitmap 可涵蓋 8GB）
+#define FS_NBUCKET       251        // 檔名雜湊表的桶數，比 FILES_MAX 大，串列平均不到一個
+#define FS_LIST_BATCH    8          // fs_list 每次持有 fs_lock 抄出的項目數
+
+struct fs_superblock {
+    uint32_t magic;
+    uint32_t block_size;    // FS_BLOCK_SIZE
+    uint32_t nblocks;       // 整個檔案系統的區塊數，含 superblock 與 metadata
+    uint32_t ninodes;
+    uint32_t bitmap_start;  // 以下都是區塊編號（從檔案系統開頭算起）
+    uint32_t bitmap_blocks;
+    uint32_t inode_start;   // 緊接在 bitmap 之後
+    uint32_t inode_blocks;
+    uint32_t data_start;    // 緊接在 inode 表之後
+};
+
+// 一段連續的區塊
+struct fs_extent {
+    uint32_t start;
+    uint32_t len;
+};
+
+// 磁碟上的 inode（128 位元組）。目錄只有一層，檔名直接放在 inode 裡。
+struct fs_inode {
+    uint32_t size;     // 位元組數
+    uint16_t flags;    // FS_INODE_*
+    uint16_t nextents;
+    char name[FS_NAME_MAX];
+    struct fs_extent extents[FS_EXTENTS]; // 依檔案中的順序
+};
+
+// 記憶體中的檔案，與 inode 表一對一
+struct file {
+    struct fs_inode *inode; // 指向記憶體中的 inode 表
+    bool busy;              // 有進程正在讀寫它（可能睡在磁碟 I/O 上）
+    int hash_next;          // 同一個雜湊桶的下一個檔案（files[] 的索引），-1 為結尾
+};
+
+struct process;
+
+void fs_init(void);
+int fs_open(struct process *proc, vaddr_t path, int flags);
+int fs_read(struct process *proc, int fd, vaddr_t buf, uint32_t len);
+int fs_write(struct process *proc, int fd, vaddr_t buf, uint32_t len);
+int fs_close(struct process *proc, int fd);
+int fs_list(vaddr_t ents, uint32_t max);
+int fs_flush(void);
+uint32_t fs_end_sector(void);
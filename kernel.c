@@ -1,15 +1,11 @@
 #include "kernel.h"
 #include "common.h"
 #include "virtio.h"
-
-// LLM 函數前向宣告
-void llm_write_file(int file_id, const char *data);
-void llm_read_file(int file_id, char *buffer);
-void llm_simulate_response(const char *input, char *response);
-
-#define UART_BASE 0x10000000
-#define UART_RHR  0x00 // 接收暫存器
-#define UART_LSR  0x05 // Line Status Register
+#include "bcache.h"
+#include "llm.h"
+#include "llm_cache.h"
+#include "uring.h"
+#include "fs.h"
 
 extern char __bss[], __bss_end[], __stack_top[];
 extern char _binary_shell_bin_start[], _binary_shell_bin_size[];
@@ -38,28 +34,6 @@ extern char __free_ram[], __free_ram_end[];
 extern paddr_t alloc_pages(uint32_t n);
 extern void map_page(uint32_t *table1, uint32_t vaddr, paddr_t paddr, uint32_t flags);
 
-struct process *current_proc; // 当前运行的进程
-struct process *idle_proc;    // 空闲进程
-
-void putchar(char ch) {
-    sbi_call(ch, 0, 0, 0, 0, 0, 0, 1 /* Console Putchar */);
-}
-
-long getchar(void) {
-    struct sbiret ret = sbi_call(0, 0, 0, 0, 0, 0, 0, 2);
-    return ret.error;
-}
-
-// 新增：非阻塞讀取UART字元（只在核心模式下使用）
-int getchar_raw(void) {
-    volatile uint8_t *uart = (volatile uint8_t *)UART_BASE;
-    if (uart[UART_LSR] & 0x01) { // Data Ready
-        return uart[UART_RHR];
-    } else {
-        return -1;
-    }
-}
-
 __attribute__((naked)) void switch_context(uint32_t *prev_sp,
                                            uint32_t *next_sp) {
     __asm__ __volatile__(
@@ -104,60 +78,342 @@ __attribute__((naked)) void switch_context(uint32_t *prev_sp,
 
 struct process procs[PROCS_MAX]; // 所有进程控制结构
 
+struct cpu cpus[CPUS_MAX];                  // 以 hartid 為索引
+static struct process idle_procs[CPUS_MAX]; // 每個 hart 一個 idle 進程，不佔 procs[] 的槽位
+
+// 保護就緒佇列、所有等待佇列、procs[] 與進程狀態。切換進程時跨過
+// switch_context 持有，由切換過去的那一邊放開。
+static struct spinlock sched_lock;
+static uint32_t idle_harts; // 正在 idle 的 hart（bitmap），受 sched_lock 保護
+// 有期限的睡眠者（以 process->timer_next 串接）與其中最早的期限，受 sched_lock 保護
+static struct process *timer_sleepers;
+static uint64_t timer_earliest = (uint64_t) -1;
+
+uint32_t time_slice_ms = TIME_SLICE_MS;
+
+void spin_lock(struct spinlock *lock) {
+    struct cpu *cpu = mycpu();
+    if (lock->locked && lock->owner == cpu)
+        PANIC("spin_lock: deadlock on hart %d", cpu->hartid);
+    while (__sync_lock_test_and_set(&lock->locked, 1))
+        ;
+    lock->owner = cpu;
+}
+
+void spin_unlock(struct spinlock *lock) {
+    lock->owner = NULL;
+    __sync_lock_release(&lock->locked);
+}
+
+// rv32 的 time 分成 time/timeh 兩半，讀到進位時重讀
+uint64_t read_time(void) {
+    uint32_t hi, lo;
+    do {
+        hi = READ_CSR(timeh);
+        lo = READ_CSR(time);
+    } while (hi != READ_CSR(timeh));
+    return ((uint64_t) hi << 32) | lo;
+}
+
+// 設定下一次計時器中斷：時間片結束或最早的睡眠期限，取較早者（同時清掉目前的 STIP）。
+// 呼叫者持有 sched_lock（開機時還沒有睡眠者，可以不持有）。
+static void timer_program(void) {
+    uint64_t next = mycpu()->slice_end;
+    if (timer_earliest < next)
+        next = timer_earliest;
+    sbi_call(next, next >> 32, 0, 0, 0, 0, 0 /* set_timer */, SBI_EXT_TIME);
+}
+
+// 開始新的時間片
+void timer_arm(void) {
+    mycpu()->slice_end = read_time() + (uint64_t) time_slice_ms * (TIMER_FREQ / 1000);
+    timer_program();
+}
+
+// 就緒佇列：與等待佇列共用同一種侵入式串列，一個進程同時只會在其中一個佇列上
+static struct wait_queue run_queue;
+
+static void proc_queue_push(struct wait_queue *q, struct process *proc) {
+    proc->queue_next = NULL;
+    if (q->tail)
+        q->tail->queue_next = proc;
+    else
+        q->head = proc;
+    q->tail = proc;
+}
+
+static void proc_queue_remove(struct wait_queue *q, struct process *proc) {
+    struct process *prev = NULL;
+    for (struct process *p = q->head; p; prev = p, p = p->queue_next) {
+        if (p != proc)
+            continue;
+        if (prev)
+            prev->queue_next = p->queue_next;
+        else
+            q->head = p->queue_next;
+        if (q->tail == p)
+            q->tail = prev;
+        p->queue_next = NULL;
+        return;
+    }
+}
+
+static struct process *proc_queue_pop(struct wait_queue *q) {
+    struct process *proc = q->head;
+    if (proc) {
+        q->head = proc->queue_next;
+        if (!q->head)
+            q->tail = NULL;
+        proc->queue_next = NULL;
+    }
+    return proc;
+}
+
+// 有 hart 在 idle 時用 IPI 叫醒一個（自己除外），新工作不必等到它的下一次時鐘中斷
+static void kick_idle_hart(void) {
+    uint32_t others = idle_harts & ~(1u << mycpu()->hartid);
+    if (!others)
+        return;
+    int hartid = 0;
+    while (!(others & (1u << hartid)))
+        hartid++;
+    idle_harts &= ~(1u << hartid);
+    sbi_call(1u << hartid, 0, 0, 0, 0, 0, 0 /* send_ipi */, SBI_EXT_IPI);
+}
+
+static void make_runnable_locked(struct process *proc) {
+    proc->state = PROC_RUNNABLE;
+    proc_queue_push(&run_queue, proc);
+    kick_idle_hart();
+}
+
+// 把進程標記為可執行並排到就緒佇列尾端
+void make_runnable(struct process *proc) {
+    spin_lock(&sched_lock);
+    make_runnable_locked(proc);
+    spin_unlock(&sched_lock);
+}
+
+// 呼叫前必須持有 sched_lock。切換後由下一個進程放開（第一次執行的進程在
+// user_entry 放開），所以舊進程的暫存器在 switch_context 存好之前，
+// 其他 hart 不可能把它從佇列上拿走。
+static void schedule(void) {
+    struct cpu *cpu = mycpu();
+    struct process *prev = cpu->proc;
+    // 目前進程若仍可執行就排回佇列尾端（round robin），再取出佇列頭
+    if (prev != cpu->idle && prev->state == PROC_RUNNABLE)
+        proc_queue_push(&run_queue, prev);
+    struct process *next = proc_queue_pop(&run_queue);
+    if (!next)
+        next = cpu->idle;
+
+    if (next == cpu->idle)
+        idle_harts |= 1u << cpu->hartid;
+    else
+        idle_harts &= ~(1u << cpu->hartid);
+
+    if (next != prev) {
+        __asm__ __volatile__(
+            "sfence.vma\n"
+            "csrw satp, %[satp]\n"
+            "sfence.vma\n"
+            "csrw sscratch, %[sscratch]\n"
+            :
+            : [satp] "r" (SATP_SV32 | ((uint32_t) next->page_table / PAGE_SIZE)),
+              [sscratch] "r" ((uint32_t) &next->stack[sizeof(next->stack)])
+        );
+
+        next->cpu = cpu;
+        cpu->proc = next;
+        cpu->context_switches++;
+        timer_arm(); // 新進程從完整的時間片開始
+        switch_context(&prev->sp, &next->sp);
+        // 回到這裡時可能已經換到另一個 hart，cpu 不能再用
+    }
+    spin_unlock(&sched_lock);
+}
+
 void yield(void) {
-    // 搜索可运行的进程
-    struct process *next = idle_proc;
-    for (int i = 0; i < PROCS_MAX; i++) {
-        struct process *proc = &procs[(current_proc->pid + i) % PROCS_MAX];
-        if (proc->state == PROC_RUNNABLE && proc->pid > 0) {
-            next = proc;
-            break;
+    spin_lock(&sched_lock);
+    schedule();
+}
+
+// 讓目前的進程睡在 wq 上，直到被 wake_up() 喚醒；睡眠中的進程不在就緒佇列上。
+// lock 保護睡眠的條件（呼叫者持有，可為 NULL）：拿到 sched_lock 之後才放開，
+// 喚醒者改條件時也持有它，所以其他 hart 不會在檢查條件與睡眠之間漏掉喚醒。
+// 醒來後重新取得 lock。
+void sleep_on(struct wait_queue *wq, struct spinlock *lock) {
+    if (lock != &sched_lock) {
+        spin_lock(&sched_lock);
+        if (lock)
+            spin_unlock(lock);
+    }
+    current_proc->state = PROC_BLOCKED;
+    proc_queue_push(wq, current_proc);
+    schedule();
+    if (lock)
+        spin_lock(lock);
+}
+
+// 從有期限的睡眠者串列移除（呼叫者持有 sched_lock）
+static void timer_remove(struct process *proc) {
+    struct process **p = &timer_sleepers;
+    while (*p && *p != proc)
+        p = &(*p)->timer_next;
+    if (*p)
+        *p = proc->timer_next;
+    proc->timer_next = NULL;
+}
+
+// 與 sleep_on 相同，但最晚在 read_time() 到達 deadline 時醒來。被 wake_up() 喚醒
+// 回傳 true，逾時回傳 false。期限只會晚不會早，呼叫者醒來後仍要重新檢查條件。
+bool sleep_on_timeout(struct wait_queue *wq, struct spinlock *lock, uint64_t deadline) {
+    if (lock != &sched_lock) {
+        spin_lock(&sched_lock);
+        if (lock)
+            spin_unlock(lock);
+    }
+    struct process *proc = current_proc;
+    proc->wake_at = deadline ? deadline : 1;
+    proc->sleep_wq = wq;
+    proc->timer_next = timer_sleepers;
+    timer_sleepers = proc;
+    if (proc->wake_at < timer_earliest)
+        timer_earliest = proc->wake_at;
+    proc->state = PROC_BLOCKED;
+    proc_queue_push(wq, proc);
+    schedule(); // 換到別的進程時會以 timer_earliest 設定這個 hart 的計時器
+
+    spin_lock(&sched_lock);
+    bool woken = proc->wake_at != 0;
+    proc->wake_at = 0;
+    if (lock != &sched_lock) {
+        spin_unlock(&sched_lock);
+        if (lock)
+            spin_lock(lock);
+    }
+    return woken;
+}
+
+// 叫醒期限已到的睡眠者並重新計算最早的期限（呼叫者持有 sched_lock）
+static void timer_wake_expired(void) {
+    uint64_t now = read_time();
+    timer_earliest = (uint64_t) -1;
+    struct process **p = &timer_sleepers;
+    while (*p) {
+        struct process *proc = *p;
+        if (proc->wake_at > now) {
+            if (proc->wake_at < timer_earliest)
+                timer_earliest = proc->wake_at;
+            p = &proc->timer_next;
+            continue;
         }
+        *p = proc->timer_next;
+        proc->timer_next = NULL;
+        proc->wake_at = 0; // 告訴 sleep_on_timeout 是逾時
+        proc_queue_remove(proc->sleep_wq, proc);
+        if (proc->state == PROC_BLOCKED)
+            make_runnable_locked(proc);
     }
+}
 
-    if (next == current_proc)
-        return;
+static void wake_up_locked(struct wait_queue *wq) {
+    struct process *proc;
+    while ((proc = proc_queue_pop(wq)) != NULL) {
+        if (proc->wake_at)
+            timer_remove(proc);
+        if (proc->state == PROC_BLOCKED)
+            make_runnable_locked(proc);
+    }
+}
 
-    __asm__ __volatile__(
-        "sfence.vma\n"
-        "csrw satp, %[satp]\n"
-        "sfence.vma\n"
-        "csrw sscratch, %[sscratch]\n"
-        :
-        : [satp] "r" (SATP_SV32 | ((uint32_t) next->page_table / PAGE_SIZE)),
-          [sscratch] "r" ((uint32_t) &next->stack[sizeof(next->stack)])
-    );
+void wake_up(struct wait_queue *wq) {
+    spin_lock(&sched_lock);
+    wake_up_locked(wq);
+    spin_unlock(&sched_lock);
+}
 
-    struct process *prev = current_proc;
-    current_proc = next;
-    switch_context(&prev->sp, &next->sp);
+// 新進程第一次被切換到時，替切換前的 schedule() 放開 sched_lock
+void proc_first_run(void) {
+    spin_unlock(&sched_lock);
 }
 
+// 進程第一次被排到時從這裡進入使用者模式；create_process() 把參數放在 s0，
+// 以 a0 交給使用者程式的 main。
 __attribute__((naked)) void user_entry(void) {
     __asm__ __volatile__(
-        "csrw sepc, %[sepc]\n"
-        "csrw sstatus, %[sstatus]\n"
+        "call proc_first_run\n"
+        "mv a0, s0\n"
+        "li t0, %[sepc]\n"
+        "csrw sepc, t0\n"
+        "li t0, %[sstatus]\n"
+        "csrw sstatus, t0\n"
         "sret\n"
         :
-        : [sepc] "r" (USER_BASE),
-          [sstatus] "r" (SSTATUS_SPIE | SSTATUS_SUM)
+        : [sepc] "i" (USER_BASE),
+          [sstatus] "i" (SSTATUS_SPIE | SSTATUS_SUM)
     );
 }
 
 extern char __kernel_base[];
 
-struct process *create_process(const void *image, size_t image_size) {
+// 核心與裝置的映射全部用 megapage 建一次，之後每個進程只複製第一層頁表
+uint32_t *kernel_page_table;
+
+void kernel_vm_init(void) {
+    kernel_page_table = (uint32_t *) alloc_pages(1);
+
+    // Kernel pages（OpenSBI 所在的 0x80000000 也會落在第一個 megapage 裡）
+    for (paddr_t paddr = (paddr_t) __kernel_base & ~(MEGAPAGE_SIZE - 1);
+         paddr < (paddr_t) __free_ram_end; paddr += MEGAPAGE_SIZE)
+        map_megapage(kernel_page_table, paddr, paddr,
+                     PAGE_R | PAGE_W | PAGE_X | PAGE_G);
+
+    // UART 與 virtio-mmio 同在 0x10000000 開始的 4MB 內
+    map_megapage(kernel_page_table, UART_BASE, UART_BASE, PAGE_R | PAGE_W | PAGE_G);
+
+    // PLIC
+    map_megapage(kernel_page_table, PLIC_BASE, PLIC_BASE, PAGE_R | PAGE_W | PAGE_G);
+}
+
+static int next_pid = 1;
+static struct proc_stats proc_counters;
+
+// 回收 zombie：釋放第一層頁表並讓槽位可以重用（呼叫者持有 sched_lock）。
+// 進程在持有 sched_lock 時才變成 zombie，並一直持有到切換完成，
+// 所以能拿到鎖看到 PROC_EXITED，它就已經不在任何 hart 上了。
+static void reap_process(struct process *proc) {
+    free_pages((paddr_t) proc->page_table, 1);
+    proc->page_table = NULL;
+    proc->parent = NULL;
+    proc->state = PROC_UNUSED;
+    proc_counters.reaped++;
+}
+
+// 建立進程；arg 會成為使用者 main 的參數。沒有空槽位時回傳 NULL。
+// 新進程還不在就緒佇列上，設定好之後由呼叫者 make_runnable()。
+struct process *create_process(const void *image, size_t image_size, int arg) {
+    // 只有挑槽位時持有 sched_lock；配置記憶體與複製映像檔期間槽位標為
+    // PROC_BLOCKED 且不在任何佇列上，不會被別的 hart 拿走或排到
     struct process *proc = NULL;
-    int i;
-    for (i = 0; i < PROCS_MAX; i++) {
+    spin_lock(&sched_lock);
+    for (int i = 0; i < PROCS_MAX; i++) {
+        // 父進程已不在的 zombie 沒有人會 wait，直接回收重用
+        if (procs[i].state == PROC_EXITED && !procs[i].parent)
+            reap_process(&procs[i]);
         if (procs[i].state == PROC_UNUSED) {
             proc = &procs[i];
+            proc->state = PROC_BLOCKED;
+            proc->pid = next_pid++;
+            proc->parent = NULL;
+            proc_counters.created++;
             break;
         }
     }
+    spin_unlock(&sched_lock);
 
     if (!proc)
-        PANIC("no free process slots");
+        return NULL;
 
     uint32_t *sp = (uint32_t *) &proc->stack[sizeof(proc->stack)];
     *--sp = 0;                      // s11
@@ -171,21 +427,13 @@ struct process *create_process(const void *image, size_t image_size) {
     *--sp = 0;                      // s3
     *--sp = 0;                      // s2
     *--sp = 0;                      // s1
-    *--sp = 0;                      // s0
+    *--sp = arg;                    // s0：由 user_entry 放進 a0
     *--sp = (uint32_t) user_entry;  // ra
 
     uint32_t *page_table = (uint32_t *) alloc_pages(1);
 
-    // Kernel pages.
-    for (paddr_t paddr = (paddr_t) __kernel_base;
-         paddr < (paddr_t) __free_ram_end; paddr += PAGE_SIZE)
-        map_page(page_table, paddr, paddr, PAGE_R | PAGE_W | PAGE_X);
-
-    // virtio-blk
-    map_page(page_table, VIRTIO_BLK_PADDR, VIRTIO_BLK_PADDR, PAGE_R | PAGE_W);
-
-    // UART
-    map_page(page_table, UART_BASE, UART_BASE, PAGE_R | PAGE_W);
+    // Kernel pages：全是 megapage 葉節點，直接複製共用的第一層項目
+    memcpy(page_table, kernel_page_table, PAGE_SIZE);
 
     // User pages.
     for (uint32_t off = 0; off < image_size; off += PAGE_SIZE) {
@@ -197,11 +445,113 @@ struct process *create_process(const void *image, size_t image_size) {
                  PAGE_U | PAGE_R | PAGE_W | PAGE_X);
     }
 
-    proc->pid = i + 1;
-    proc->state = PROC_RUNNABLE;
     proc->sp = (uint32_t) sp;
     proc->page_table = page_table;
-    return proc;
+    proc->uring = NULL;
+    proc->uring_sqpoll = false;
+    memset(proc->fds, 0, sizeof(proc->fds));
+    proc->exit_status = 0;
+    proc->wait_children.head = proc->wait_children.tail = NULL;
+    return proc; // 呼叫者以 make_runnable() 放進就緒佇列
+}
+
+// 結束目前進程：立即釋放使用者記憶體，留下 zombie 給父進程回收。
+// 第一層頁表還在使用中（satp），等 reap_process() 再釋放。
+__attribute__((noreturn)) void exit_process(int status) {
+    struct process *proc = current_proc;
+    unmap_user_pages(proc->page_table);
+    proc->uring = NULL; // 環的頁面已隨使用者頁面釋放
+    llm_release(proc->pid);
+
+    spin_lock(&sched_lock);
+    proc->exit_status = status;
+    for (int i = 0; i < PROCS_MAX; i++) {
+        struct process *child = &procs[i];
+        if (child->parent != proc)
+            continue;
+        child->parent = NULL;
+        if (child->state == PROC_EXITED)
+            reap_process(child);
+    }
+
+    proc->state = PROC_EXITED;
+    if (proc->parent)
+        wake_up_locked(&proc->parent->wait_children);
+    schedule();
+    PANIC("unreachable");
+}
+
+// 等待子進程（pid 為 -1 表示任一個）結束並回收；沒有符合的子進程或 status
+// 不是可寫的使用者位址時回傳 -1
+int wait_process(int pid, vaddr_t status) {
+    // 先檢查，免得收走子進程之後才發現結束碼寫不回去
+    if (status && !user_range_ok(current_proc->page_table, status, sizeof(int), PAGE_U | PAGE_W))
+        return -1;
+
+    spin_lock(&sched_lock);
+    while (1) {
+        bool has_child = false;
+        for (int i = 0; i < PROCS_MAX; i++) {
+            struct process *child = &procs[i];
+            if (child->parent != current_proc || child->state == PROC_UNUSED
+                || (pid >= 0 && child->pid != pid))
+                continue;
+
+            has_child = true;
+            if (child->state == PROC_EXITED) {
+                int child_pid = child->pid;
+                int child_status = child->exit_status;
+                reap_process(child);
+                spin_unlock(&sched_lock);
+                if (status)
+                    copy_to_user(status, &child_status, sizeof(child_status)); // 在鎖外寫入
+                return child_pid;
+            }
+        }
+
+        if (!has_child) {
+            spin_unlock(&sched_lock);
+            return -1;
+        }
+        sleep_on(&current_proc->wait_children, &sched_lock);
+    }
+}
+
+void get_proc_stats(struct proc_stats *out) {
+    spin_lock(&sched_lock);
+    struct proc_stats stats = proc_counters;
+    stats.live = stats.zombie = 0;
+    for (int i = 0; i < PROCS_MAX; i++) {
+        if (procs[i].state == PROC_EXITED)
+            stats.zombie++;
+        else if (procs[i].state != PROC_UNUSED)
+            stats.live++;
+    }
+    spin_unlock(&sched_lock);
+    *out = stats;
+}
+
+// 填入每個已上線 hart 的使用率，回傳筆數
+int get_cpu_stats(struct cpu_stats *out, int max) {
+    uint64_t now = read_time();
+    int n = 0;
+    for (int i = 0; i < CPUS_MAX && n < max; i++) {
+        struct cpu *cpu = &cpus[i];
+        if (!cpu->online)
+            continue;
+
+        // rv32 沒有 64 位元除法：以 2^16 個 tick（約 6.5ms）為單位換成 32 位元再算
+        uint32_t total = (uint32_t) ((now - cpu->online_since) >> 16);
+        uint32_t idle = (uint32_t) (cpu->idle_time >> 16);
+        struct process *proc = cpu->proc;
+        struct cpu_stats st;
+        st.hartid = cpu->hartid;
+        st.busy_percent = total > idle ? (total - idle) * 100 / total : 0;
+        st.context_switches = cpu->context_switches;
+        st.pid = proc ? proc->pid : -1;
+        out[n++] = st;
+    }
+    return n;
 }
 
 void delay(void) {
@@ -309,191 +659,440 @@ void kernel_entry(void) {
     );
 }
 
+// 使用者緩衝區與磁碟之間直接 DMA，不經過核心緩衝區。len 須為 SECTOR_SIZE 的倍數。
+int user_disk_rw(vaddr_t buf, unsigned sector, size_t len, int is_write) {
+    if (len % SECTOR_SIZE != 0)
+        return -1;
+
+    // 與磁區快取保持一致：先寫回髒資料，寫入後再讓舊的快取失效
+    unsigned nsectors = len / SECTOR_SIZE;
+    if (bcache_sync_range(sector, nsectors, false) < 0)
+        return -1;
+    while (len > 0) {
+        // (BLK_MAX_SEGS - 1) 頁的範圍最多橫跨 BLK_MAX_SEGS 個頁面
+        size_t chunk = (BLK_MAX_SEGS - 1) * PAGE_SIZE;
+        if (chunk > len)
+            chunk = len;
+
+        struct blk_iovec iov[BLK_MAX_SEGS];
+        int n = user_buf_to_iov(current_proc->page_table, buf, chunk, !is_write,
+                                iov, BLK_MAX_SEGS);
+        if (n < 0)
+            return -1;
+        if ((is_write ? blk_writev(sector, iov, n) : blk_readv(sector, iov, n)) < 0)
+            return -1;
+
+        buf += chunk;
+        sector += chunk / SECTOR_SIZE;
+        len -= chunk;
+    }
+    if (is_write)
+        bcache_sync_range(sector - nsectors, nsectors, true);
+    return 0;
+}
+
+// LLM 請求環的 header 與檔案系統的 metadata 都快取在記憶體裡，使用者直接
+// 改掉磁碟上的內容會讓兩者不一致，下次寫回時也會被蓋掉
+int user_raw_disk_rw(vaddr_t buf, unsigned sector, size_t len, int is_write) {
+    unsigned end = sector + len / SECTOR_SIZE;
+    if (end < sector || sector < LLM_REQ_SECTOR(LLM_RING_SLOTS)
+        || (sector < fs_end_sector() && end > FS_BASE_SECTOR))
+        return -1;
+    return user_disk_rw(buf, sector, len, is_write);
+}
+
 void handle_syscall(struct trap_frame *f) {
     switch (f->a3) {
         case SYS_PUTCHAR:
             putchar(f->a0);
             break;
         case SYS_GETCHAR:
-            while (1) {
-                long ch = getchar();
-                if (ch >= 0) {
-                    f->a0 = ch;
-                    break;
-                }
-                yield();
-            }
+            f->a0 = console_getc(true);
             break;
         case SYS_GETCHAR_NONBLOCK:
-            f->a0 = getchar_raw();
+            f->a0 = console_getc(false);
+            break;
+        case SYS_SYNC:
+            // 先寫檔案內容再寫 metadata：中途當機時，磁碟上的 inode 不會
+            // 涵蓋還沒寫下去的磁區。內容寫不回去時 metadata 也先不寫。
+            // 有寫不回磁碟的資料時回傳 -1（資料仍留在記憶體，下次再寫）
+            f->a0 = (bcache_flush() < 0 || fs_flush() < 0) ? -1 : 0;
+            break;
+        case SYS_BCACHE_STATS:
+            {
+                struct bcache_stats stats;
+                bcache_get_stats(&stats);
+                f->a0 = copy_to_user(f->a0, &stats, sizeof(stats));
+            }
+            break;
+        case SYS_MEM_STATS:
+            {
+                struct mm_stats stats;
+                mm_get_stats(&stats);
+                f->a0 = copy_to_user(f->a0, &stats, sizeof(stats));
+            }
+            break;
+        case SYS_DISK_READ:
+        case SYS_DISK_WRITE:
+            f->a0 = user_raw_disk_rw(f->a0, f->a1, f->a2, f->a3 == SYS_DISK_WRITE);
             break;
 
         // LLM 相關系統呼叫
         case 200: // SYS_LLM_SEND_REQUEST
-            {
-                char request[LLM_MAX_MSG_SIZE];
-                char *user_request = (char*)f->a0;
-                strcpy(request, user_request);
-                llm_write_file(LLM_REQUEST_FILE, request);
-                llm_write_file(LLM_STATUS_FILE, "request_sent");
-                f->a0 = 0; // 成功
-            }
+            // 回傳請求 ID；請求環已滿（最舊的槽位還沒取回）時回傳 -1
+            f->a0 = llm_submit(f->a0);
             break;
 
         case 201: // SYS_LLM_GET_RESPONSE
-            {
-                char response[LLM_MAX_MSG_SIZE];
-                char status[64];
-                llm_read_file(LLM_STATUS_FILE, status);
-
-                // 清理狀態字串，移除 null bytes
-                for (int i = 0; i < 63; i++) {
-                    if (status[i] == '\0') {
-                        status[i] = '\0';
-                        break;
-                    }
-                }
+            // a1 為請求 ID；有回應回傳 1，還沒有回傳 0，ID 無效回傳 -1
+            f->a0 = llm_poll(f->a0, f->a1);
+            break;
 
-                if (strcmp(status, "response_ready") == 0) {
-                    llm_read_file(LLM_RESPONSE_FILE, response);
-                    char *user_buffer = (char*)f->a0;
-                    strcpy(user_buffer, response);
-                    llm_write_file(LLM_STATUS_FILE, "idle");
-                    f->a0 = 1; // 有回應
-                } else {
-                    f->a0 = 0; // 無回應
-                }
+        case SYS_LLM_STREAM:
+            // a1 為請求 ID，a2 為已讀取的位元組數；回傳新增的位元組數
+            f->a0 = llm_stream(f->a0, f->a1, f->a2);
+            break;
+
+        case SYS_LLM_CACHE_STATS:
+            {
+                struct llm_cache_stats stats;
+                llm_cache_get_stats(&stats);
+                f->a0 = copy_to_user(f->a0, &stats, sizeof(stats));
             }
             break;
 
+        case SYS_LLM_CACHE_TTL:
+            // a0 為秒數（0 表示不過期，負數只查詢）；回傳原本的值
+            f->a0 = llm_cache_set_ttl(f->a0);
+            break;
+
+        case SYS_LLM_WAIT:
+            // a0 為請求 ID，a1 為已讀取的位元組數，a2 為最多等待的毫秒數；
+            // 有新內容回傳 1，逾時回傳 0，ID 無效回傳 -1
+            f->a0 = llm_wait(f->a0, f->a1, f->a2);
+            break;
+
+        case SYS_LLM_CANCEL:
+            f->a0 = llm_cancel(f->a0);
+            break;
+
         case 202: // SYS_LLM_SIMULATE
             {
-                char request[LLM_MAX_MSG_SIZE];
-                char response[LLM_MAX_MSG_SIZE];
+                char request[256]; // 只比對關鍵字，過長的請求截斷即可
+                char response[256];
                 char *user_request = (char*)f->a0;
                 char *user_response = (char*)f->a1;
 
-                strcpy(request, user_request);
+                size_t n = 0;
+                while (n < sizeof(request) - 1 && user_request[n]) {
+                    request[n] = user_request[n];
+                    n++;
+                }
+                request[n] = '\0';
                 llm_simulate_response(request, response);
                 strcpy(user_response, response);
                 f->a0 = 0; // 成功
             }
             break;
+        case SYS_SPAWN:
+            {
+                struct process *child = create_process(
+                    _binary_shell_bin_start, (size_t) _binary_shell_bin_size, f->a0);
+                if (child) {
+                    child->parent = current_proc;
+                    make_runnable(child);
+                    f->a0 = child->pid;
+                } else {
+                    f->a0 = -1;
+                }
+            }
+            break;
+        case SYS_WAIT:
+            f->a0 = wait_process(f->a0, f->a1);
+            break;
+        case SYS_PROC_STATS:
+            {
+                struct proc_stats stats;
+                get_proc_stats(&stats);
+                f->a0 = copy_to_user(f->a0, &stats, sizeof(stats));
+            }
+            break;
+        case SYS_SET_TIME_SLICE:
+            {
+                // 參數為 0 時只回傳目前的時間片長度
+                uint32_t old_slice = time_slice_ms;
+                if (f->a0 > 0 && f->a0 <= 1000)
+                    time_slice_ms = f->a0;
+                f->a0 = old_slice;
+            }
+            break;
+        case SYS_CPU_STATS:
+            // a1 為陣列長度，最多用到 CPUS_MAX 筆；回傳筆數，緩衝區無效時回傳 -1
+            {
+                struct cpu_stats stats[CPUS_MAX];
+                uint32_t max = f->a1 < CPUS_MAX ? f->a1 : CPUS_MAX;
+                if (!user_range_ok(current_proc->page_table, f->a0, max * sizeof(stats[0]),
+                                   PAGE_U | PAGE_W)) {
+                    f->a0 = -1;
+                    break;
+                }
+                int n = get_cpu_stats(stats, max);
+                f->a0 = copy_to_user(f->a0, stats, n * sizeof(stats[0])) < 0 ? -1 : n;
+            }
+            break;
+        case SYS_URING_SETUP:
+            // a0 為 URING_SETUP_* 旗標；回傳環的使用者位址
+            f->a0 = uring_setup(current_proc, f->a0);
+            break;
+        case SYS_URING_ENTER:
+            // 處理提交環上的操作，回傳處理的數量
+            f->a0 = uring_enter(current_proc);
+            break;
+        case SYS_OPEN:
+            // a1 為 O_* 旗標；回傳 fd，失敗回傳 -1
+            f->a0 = fs_open(current_proc, f->a0, f->a1);
+            break;
+        case SYS_READ:
+        case SYS_WRITE:
+            // a0 為 fd，a1 為緩衝區，a2 為長度；回傳讀寫的位元組數
+            f->a0 = f->a3 == SYS_WRITE ? fs_write(current_proc, f->a0, f->a1, f->a2)
+                                       : fs_read(current_proc, f->a0, f->a1, f->a2);
+            break;
+        case SYS_CLOSE:
+            f->a0 = fs_close(current_proc, f->a0);
+            break;
+        case SYS_LIST:
+            // a0 為 struct fs_dirent 陣列，a1 為它的長度；回傳檔案總數
+            f->a0 = fs_list(f->a0, f->a1);
+            break;
         case SYS_EXIT:
-            printf("process %d exited\n", current_proc->pid);
-            current_proc->state = PROC_EXITED;
-            yield();
-            PANIC("unreachable");
+            if (!current_proc->parent) // 有父進程時由父進程透過 SYS_WAIT 取得結束碼
+                printf("process %d exited (status %d)\n", current_proc->pid, f->a0);
+            exit_process(f->a0);
         default:
             PANIC("unexpected syscall a3=%x\n", f->a3);
     }
 }
 
+void plic_init(void) {
+    *(volatile uint32_t *) PLIC_PRIORITY(VIRTIO_BLK_IRQ) = 1;
+    *(volatile uint32_t *) PLIC_PRIORITY(UART_IRQ) = 1;
+    *(volatile uint32_t *) PLIC_PRIORITY(VIRTIO_CONSOLE_IRQ) = 1;
+}
+
+// 每個 hart 各自的 S-mode context；中斷送到所有 hart，先 claim 到的處理
+void plic_init_hart(uint32_t hartid) {
+    *(volatile uint32_t *) PLIC_SENABLE(hartid) =
+        (1 << VIRTIO_BLK_IRQ) | (1 << VIRTIO_CONSOLE_IRQ) | (1 << UART_IRQ);
+    *(volatile uint32_t *) PLIC_STHRESHOLD(hartid) = 0;
+    WRITE_CSR(sie, READ_CSR(sie) | SIE_SEIE);
+}
+
+void handle_external_interrupt(void) {
+    uint32_t hartid = mycpu()->hartid;
+    uint32_t irq;
+    while ((irq = *(volatile uint32_t *) PLIC_SCLAIM(hartid)) != 0) {
+        if (irq == VIRTIO_BLK_IRQ)
+            virtio_blk_handle_irq();
+        else if (irq == VIRTIO_CONSOLE_IRQ)
+            virtio_console_handle_irq();
+        else if (irq == UART_IRQ)
+            uart_handle_irq();
+        else
+            printf("unexpected irq %d\n", irq);
+        *(volatile uint32_t *) PLIC_SCLAIM(hartid) = irq;
+    }
+}
+
+// 計時器中斷可能是時間片用完，也可能只是有睡眠者的期限到了
+void handle_timer_interrupt(void) {
+    spin_lock(&sched_lock);
+    timer_wake_expired();
+    bool slice_over = read_time() >= mycpu()->slice_end;
+    if (slice_over)
+        timer_arm();
+    else
+        timer_program();
+    spin_unlock(&sched_lock);
+    console_flush();
+    if (slice_over && current_proc != idle_proc)
+        mycpu()->need_resched = true;
+}
+
+void handle_interrupt(uint32_t code) {
+    switch (code) {
+        case IRQ_S_SOFT:
+            // kick_idle_hart() 的 IPI 只是要把 hart 從 wfi 叫醒，清掉即可
+            WRITE_CSR(sip, READ_CSR(sip) & ~SIP_SSIP);
+            break;
+        case IRQ_S_TIMER:
+            handle_timer_interrupt();
+            break;
+        case IRQ_S_EXTERNAL:
+            handle_external_interrupt();
+            break;
+        default:
+            PANIC("unexpected interrupt code=%d", code);
+    }
+}
+
+// idle 進程：沒有可執行的進程時以 wfi 等待中斷。核心態不開 SIE，
+// 所以醒來後直接查 sip 並處理，處理過程中喚醒的進程由下一輪 yield() 接手。
+// idle 進程不會換 hart，cpu 可以一直用。
+void idle_loop(void) {
+    struct cpu *cpu = mycpu();
+    while (1) {
+        yield();
+        console_flush();
+        uint64_t start = read_time();
+        __asm__ __volatile__("wfi");
+        cpu->idle_time += read_time() - start;
+
+        uint32_t sip = READ_CSR(sip);
+        if (sip & SIP_SSIP)
+            handle_interrupt(IRQ_S_SOFT);
+        if (sip & SIP_STIP)
+            handle_interrupt(IRQ_S_TIMER);
+        if (sip & SIP_SEIP)
+            handle_interrupt(IRQ_S_EXTERNAL);
+    }
+}
+
+// trap frame 緊貼在進程核心棧的頂端，由它的位置反推出進程
+static struct process *trap_frame_proc(struct trap_frame *f) {
+    return (struct process *) ((uint8_t *) (f + 1) - sizeof(procs[0].stack)
+                               - offsetof(struct process, stack));
+}
+
 void handle_trap(struct trap_frame *f) {
+    // 使用者程式可以任意改 tp，先讓它重新指向這個 hart 的 struct cpu
+    struct cpu *cpu = trap_frame_proc(f)->cpu;
+    __asm__ __volatile__("mv tp, %0" :: "r"(cpu));
+
     uint32_t scause = READ_CSR(scause);
     uint32_t stval = READ_CSR(stval);
     uint32_t user_pc = READ_CSR(sepc);
-    if (scause == SCAUSE_ECALL) {
+    // 睡眠或被搶佔後可能在別的 hart 上返回，sepc/sstatus 都要用自己的
+    uint32_t user_sstatus = READ_CSR(sstatus);
+    if (scause & SCAUSE_INTERRUPT) {
+        handle_interrupt(scause & ~SCAUSE_INTERRUPT);
+        uring_sqpoll(current_proc);
+        // 搶佔：時間片用完就讓出 CPU，進程維持 RUNNABLE
+        if (mycpu()->need_resched) {
+            mycpu()->need_resched = false;
+            yield();
+        }
+    } else if (scause == SCAUSE_ECALL) {
         handle_syscall(f);
         user_pc += 4;
     } else {
-        PANIC("unexpected trap scause=%x, stval=%x, sepc=%x\n", scause, stval, user_pc);
+        PANIC("unexpected trap scause=%x, stval=%p, sepc=%p\n", scause, stval, user_pc);
     }
 
     WRITE_CSR(sepc, user_pc);
+    WRITE_CSR(sstatus, user_sstatus);
 }
 
+// 設定這個 hart 的 struct cpu 與 idle 進程，並讓 tp 指向它。
+// idle 進程只用核心映射，直接使用共用的 kernel_page_table。
+static void cpu_init(uint32_t hartid) {
+    struct cpu *cpu = &cpus[hartid];
+    __asm__ __volatile__("mv tp, %0" :: "r"(cpu));
+    // 進程會在 hart 之間移動，每個 hart 都要能直接存取使用者記憶體
+    WRITE_CSR(sstatus, READ_CSR(sstatus) | SSTATUS_SUM);
+    // 讓使用者程式可以用 rdcycle/rdinstret 量測（bench 命令）
+    WRITE_CSR(scounteren, SCOUNTEREN_CY | SCOUNTEREN_IR);
+
+    struct process *idle = &idle_procs[hartid];
+    idle->pid = -1;
+    idle->state = PROC_RUNNABLE;
+    idle->page_table = kernel_page_table;
+    idle->cpu = cpu;
+
+    cpu->hartid = hartid;
+    cpu->idle = idle;
+    cpu->proc = idle;
+    cpu->online_since = read_time();
+    cpu->online = true;
+}
 
-void kernel_main(void) {
+// 其他 hart 由 SBI HSM 從這裡開始執行：a0 = hartid，a1 = 核心棧頂（opaque）
+__attribute__((naked)) void secondary_entry(void) {
+    __asm__ __volatile__(
+        "mv sp, a1\n"
+        "j secondary_main\n"
+    );
+}
+
+void secondary_main(uint32_t hartid) {
+    WRITE_CSR(stvec, (uint32_t) kernel_entry);
+    cpu_init(hartid);
+    plic_init_hart(hartid);
+    WRITE_CSR(sie, READ_CSR(sie) | SIE_STIE | SIE_SSIE);
+    timer_arm();
+    idle_loop();
+}
+
+// 以 SBI HSM 啟動其他 hart，各自以 idle 進程的核心棧當作開機用的棧。
+// 不存在的 hartid 會回傳錯誤，直接略過。
+static void start_secondary_harts(uint32_t boot_hartid) {
+    int started = 0;
+    for (uint32_t hartid = 0; hartid < CPUS_MAX; hartid++) {
+        if (hartid == boot_hartid)
+            continue;
+        struct process *idle = &idle_procs[hartid];
+        struct sbiret ret = sbi_call(hartid, (long) secondary_entry,
+                                     (long) &idle->stack[sizeof(idle->stack)],
+                                     0, 0, 0, 0 /* hart_start */, SBI_EXT_HSM);
+        if (ret.error == 0)
+            started++;
+    }
+    printf("smp: boot hart %d, started %d more\n", boot_hartid, started);
+}
+
+void kernel_main(uint32_t hartid) {
     memset(__bss, 0, (size_t)__bss_end - (size_t)__bss);
 
+    if (hartid >= CPUS_MAX)
+        PANIC("boot hart %d exceeds CPUS_MAX", hartid);
+    // 開機期間 cpus[] 全為 0：current_proc 為 NULL，磁碟 I/O 以忙等完成。
+    // printf 會上鎖，tp 要先設好。
+    __asm__ __volatile__("mv tp, %0" :: "r"(&cpus[hartid]));
+
     printf("\n\n");
 
     WRITE_CSR(stvec, (uint32_t) kernel_entry);
 	virtio_blk_init();
+    bcache_init();
+    virtio_console_init(); // 可有可無；沒接時 LLM 走磁碟上的請求環
 
-	char buf[SECTOR_SIZE];
-    read_write_disk(buf, 0, false /* 从磁盘读取 */);
-    printf("first sector: %s\n", buf);
-
-    strcpy(buf, "hello from kernel!!!\n");
-    read_write_disk(buf, 0, true /* 写入磁盘 */);
-
-    // 初始化 LLM 檔案系統
-    llm_write_file(LLM_STATUS_FILE, "idle");
-    printf("LLM 檔案系統已初始化\n");
+    llm_init();
+    fs_init();
 
-    idle_proc = create_process(NULL, 0);
-    idle_proc->pid = -1;
-    current_proc = idle_proc;
+    kernel_vm_init();
+    cpu_init(hartid);
 
-    create_process(_binary_shell_bin_start, (size_t)_binary_shell_bin_size);
-
-    yield();
-    PANIC("switched to idle process");
+    struct process *shell = create_process(_binary_shell_bin_start,
+                                           (size_t)_binary_shell_bin_size, 0);
+    if (!shell)
+        PANIC("no free process slots");
+    make_runnable(shell);
+
+    uart_init();
+    plic_init();
+    plic_init_hart(hartid);
+    WRITE_CSR(sie, READ_CSR(sie) | SIE_STIE | SIE_SSIE);
+    timer_arm();
+    start_secondary_harts(hartid);
+    idle_loop();
 }
 
+// OpenSBI 以 a0 = hartid 進入；用 la 設定棧，不能讓編譯器拿 a0 當暫存器
 __attribute__((section(".text.boot")))
 __attribute__((naked))
 void boot(void) {
     __asm__ __volatile__(
-        "mv sp, %[stack_top]\n" // 设置栈指针
+        "la sp, __stack_top\n" // 设置栈指针
         "j kernel_main\n"
-        :
-        : [stack_top] "r" (__stack_top)
     );
 }
-
-// LLM 檔案操作函數
-void llm_write_file(int file_id, const char *data) {
-    char filename[32];
-    if (file_id == LLM_REQUEST_FILE) {
-        strcpy(filename, "llm_request.txt");
-    } else if (file_id == LLM_RESPONSE_FILE) {
-        strcpy(filename, "llm_response.txt");
-    } else if (file_id == LLM_STATUS_FILE) {
-        strcpy(filename, "llm_status.txt");
-    } else {
-        return;
-    }
-
-    // 寫入到磁碟的第一個磁區（模擬檔案系統）
-    char buffer[SECTOR_SIZE];
-    memset(buffer, 0, SECTOR_SIZE);
-    strcpy(buffer, data);
-    read_write_disk(buffer, file_id, true); // 寫入
-}
-
-void llm_read_file(int file_id, char *buffer) {
-    char filename[32];
-    if (file_id == LLM_REQUEST_FILE) {
-        strcpy(filename, "llm_request.txt");
-    } else if (file_id == LLM_RESPONSE_FILE) {
-        strcpy(filename, "llm_response.txt");
-    } else if (file_id == LLM_STATUS_FILE) {
-        strcpy(filename, "llm_status.txt");
-    } else {
-        return;
-    }
-
-    // 從磁碟讀取（模擬檔案系統）
-    char disk_buffer[SECTOR_SIZE];
-    read_write_disk(disk_buffer, file_id, false); // 讀取
-    strcpy(buffer, disk_buffer);
-}
-
-// 模擬 LLM 回應（暫時使用）
-void llm_simulate_response(const char *input, char *response) {
-    if (strstr(input, "你好") || strstr(input, "hello")) {
-        strcpy(response, "你好！我是基於 RISC-V OS 的 AI 助手。");
-    } else if (strstr(input, "幫助") || strstr(input, "help")) {
-        strcpy(response, "我可以幫助你了解這個作業系統，或者回答一些基本問題。");
-    } else if (strstr(input, "系統") || strstr(input, "system")) {
-        strcpy(response, "這是一個 RISC-V 32位元作業系統，支援多工處理、虛擬記憶體和檔案系統。");
-    } else if (strstr(input, "謝謝") || strstr(input, "thank")) {
-        strcpy(response, "不客氣！還有什麼我可以幫助你的嗎？");
-    } else {
-        strcpy(response, "我理解你的輸入，這很有趣！請告訴我更多。");
-    }
-}
-
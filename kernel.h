@@ -5,23 +5,49 @@
 #define PROCS_MAX 8
 #define PROC_UNUSED   0
 #define PROC_RUNNABLE 1
-#define PROC_EXITED   2
+#define PROC_EXITED   2 // zombie：位址空間已釋放，等待父進程回收
+#define PROC_BLOCKED  3
 #define SATP_SV32 (1u << 31)
 #define SSTATUS_SPIE (1 << 5)
 #define SSTATUS_SUM  (1 << 18)
+#define SCOUNTEREN_CY (1 << 0)
+#define SCOUNTEREN_IR (1 << 2)
 #define SCAUSE_ECALL 8
+#define SCAUSE_INTERRUPT (1u << 31)
+#define IRQ_S_SOFT       1
+#define IRQ_S_TIMER      5
+#define IRQ_S_EXTERNAL   9
+#define SIE_SSIE (1 << 1)
+#define SIE_STIE (1 << 5)
+#define SIE_SEIE (1 << 9)
+#define SIP_SSIP (1 << 1)
+#define SIP_STIP (1 << 5)
+#define SIP_SEIP (1 << 9)
+#define SBI_EXT_BASE  0x10
+#define SBI_EXT_TIME  0x54494D45
+#define SBI_EXT_DBCN  0x4442434E
+#define SBI_EXT_IPI   0x735049
+#define SBI_EXT_HSM   0x48534D
+#define TIMER_FREQ    10000000 // QEMU virt 的 time CSR 頻率 (10MHz)
+#define TIME_SLICE_MS 10       // 預設時間片，可用 SYS_SET_TIME_SLICE 調整
 #define PAGE_V    (1 << 0)
 #define PAGE_R    (1 << 1)
 #define PAGE_W    (1 << 2)
 #define PAGE_X    (1 << 3)
 #define PAGE_U    (1 << 4)
+#define PAGE_G    (1 << 5)
+#define MEGAPAGE_SIZE (4 * 1024 * 1024) // Sv32 第一層葉節點
 #define USER_BASE 0x1000000
-#define FILES_MAX   2
-#define DISK_MAX_SIZE     align_up(sizeof(struct file) * FILES_MAX, SECTOR_SIZE)
+#define URING_VADDR 0x1800000 // 使用者映像的上限（見 user.ld）之後
+#define FILES_MAX   128 // 檔案系統最多的 inode 數（見 fs.h）
+#define FDS_MAX     8   // 每個進程同時開啟的檔案數
+#define FS_BASE_SECTOR 640 // 檔案系統從 320KB 開始，前面是 LLM 請求環（見 llm.h）
 #define SECTOR_SIZE       512
 #define VIRTQ_ENTRY_NUM   16
 #define VIRTIO_DEVICE_BLK 2
-#define VIRTIO_BLK_PADDR  0x10001000
+#define VIRTIO_DEVICE_CONSOLE 3
+#define VIRTIO_BLK_PADDR  0x10001000     // virtio-mmio-bus.0
+#define VIRTIO_CONSOLE_PADDR 0x10002000  // virtio-mmio-bus.1
 #define VIRTIO_REG_MAGIC         0x00
 #define VIRTIO_REG_VERSION       0x04
 #define VIRTIO_REG_DEVICE_ID     0x08
@@ -31,6 +57,8 @@
 #define VIRTIO_REG_QUEUE_ALIGN   0x3c
 #define VIRTIO_REG_QUEUE_PFN     0x40
 #define VIRTIO_REG_QUEUE_NOTIFY  0x50
+#define VIRTIO_REG_INTERRUPT_STATUS 0x60
+#define VIRTIO_REG_INTERRUPT_ACK    0x64
 #define VIRTIO_REG_DEVICE_STATUS 0x70
 #define VIRTIO_REG_DEVICE_CONFIG 0x100
 #define VIRTIO_STATUS_ACK       1
@@ -42,12 +70,78 @@
 #define VIRTQ_AVAIL_F_NO_INTERRUPT 1
 #define VIRTIO_BLK_T_IN  0
 #define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_IRQ   1
+#define VIRTIO_CONSOLE_IRQ 2
+
+// 16550 UART (QEMU virt)
+#define UART_BASE 0x10000000
+#define UART_IRQ  10
+#define UART_RHR  0x00 // 接收暫存器
+#define UART_IER  0x01 // Interrupt Enable Register
+#define UART_FCR  0x02 // FIFO Control Register
+#define UART_MCR  0x04 // Modem Control Register
+#define UART_LSR  0x05 // Line Status Register
+#define UART_IER_RX   0x01 // 收到資料時發出中斷
+#define UART_FCR_FIFO 0x07 // 啟用並清空 FIFO，每收到 1 個位元組就觸發
+#define UART_MCR_OUT2 0x08 // 16550 要設定 OUT2 才會把中斷送出去
+#define UART_LSR_DR   0x01 // Data Ready
+
+// PLIC (QEMU virt)，S-mode context = hart * 2 + 1
+#define PLIC_BASE              0x0c000000
+#define PLIC_PRIORITY(irq)     (PLIC_BASE + (irq) * 4)
+#define PLIC_SENABLE(hart)     (PLIC_BASE + 0x2080 + (hart) * 0x100)
+#define PLIC_STHRESHOLD(hart)  (PLIC_BASE + 0x201000 + (hart) * 0x2000)
+#define PLIC_SCLAIM(hart)      (PLIC_BASE + 0x201004 + (hart) * 0x2000)
+
+struct process;
+
+// 核心從不在 S-mode 開中斷，所以 spinlock 不必關中斷，只要防止其他 hart 同時進入
+struct spinlock {
+    volatile uint32_t locked;
+    struct cpu *owner; // 用來抓同一個 hart 重複上鎖
+};
+
+// 每個 hart 的狀態，由 tp 暫存器指向
+struct cpu {
+    int hartid;
+    bool online;
+    bool need_resched;          // 時間片用完，回到使用者模式前要先讓出 CPU
+    struct process *proc;       // 目前執行的進程（current_proc）
+    struct process *idle;       // 這個 hart 的 idle 進程（idle_proc）
+    uint32_t context_switches;
+    uint64_t slice_end;         // read_time()：目前時間片結束的時間
+    uint64_t online_since;      // read_time()：hart 開始排程的時間
+    uint64_t idle_time;         // 花在 idle 的 wfi 上的時間
+};
+
+// 等待佇列：以 process->queue_next 串起的單向鏈結（就緒佇列也用同一種結構）
+struct wait_queue {
+    struct process *head;
+    struct process *tail;
+};
+
+// 進程開啟的檔案；file 為 NULL 表示這個 fd 沒有在用
+struct open_file {
+    struct file *file;
+    uint32_t offset;
+};
 
 struct process {
     int pid; // -1 if it's an idle process
-    int state; // PROC_UNUSED, PROC_RUNNABLE, PROC_EXITED
+    int state; // PROC_UNUSED, PROC_RUNNABLE, PROC_EXITED, PROC_BLOCKED
     vaddr_t sp; // kernel stack pointer
+    struct process *queue_next; // next process in the run queue or a wait_queue
+    uint64_t wake_at;           // sleep_on_timeout 的期限，逾時後設為 0
+    struct wait_queue *sleep_wq; // sleep_on_timeout 睡在哪個佇列上
+    struct process *timer_next;  // 有期限的睡眠者串列
+    struct process *parent;    // NULL：沒有父進程（或父進程已結束）
+    int exit_status;
+    struct wait_queue wait_children; // 父進程在 SYS_WAIT 中等待子進程結束
     uint32_t *page_table; // points to first level page table
+    struct uring *uring;  // SYS_URING_SETUP 映射的環（核心位址），沒有時為 NULL
+    bool uring_sqpoll;    // 中斷時由核心處理提交環
+    struct open_file fds[FDS_MAX];
+    struct cpu *cpu;      // 目前（或最後一次）執行這個進程的 hart
     uint8_t stack[8192]; // kernel stack
 };
 
@@ -118,50 +212,84 @@ struct virtio_virtq {
     struct virtq_desc descs[VIRTQ_ENTRY_NUM];
     struct virtq_avail avail;
     struct virtq_used used __attribute__((aligned(PAGE_SIZE)));
+    paddr_t mmio_base;
     int queue_index;
     volatile uint16_t *used_index;
-    uint16_t last_used_index;
+    uint16_t last_used_index; // 下一個要回收的 used entry
+    uint16_t free_head;       // descriptor free list（以 desc.next 串接）
+    uint16_t num_free;
 } __attribute__((packed));
 
+// 資料不再經過 bounce buffer：data descriptor 直接指向呼叫者的緩衝區
 struct virtio_blk_req {
     uint32_t type;
     uint32_t reserved;
     uint64_t sector;
-    uint8_t data[512];
     uint8_t status;
 } __attribute__((packed));
 
-struct tar_header {
-    char name[100];
-    char mode[8];
-    char uid[8];
-    char gid[8];
-    char size[12];
-    char mtime[12];
-    char checksum[8];
-    char type;
-    char linkname[100];
-    char magic[6];
-    char version[2];
-    char uname[32];
-    char gname[32];
-    char devmajor[8];
-    char devminor[8];
-    char prefix[155];
-    char padding[12];
-    char data[];
-} __attribute__((packed));
+// 每個請求至少用 header、data、status 三個 descriptor
+#define VIRTIO_BLK_REQ_MAX (VIRTQ_ENTRY_NUM / 3)
+// 單一請求最多可串接的 data 段數
+#define BLK_MAX_SEGS       (VIRTQ_ENTRY_NUM - 2)
+
+// 一段實體連續的緩衝區（核心記憶體為恆等映射，位址即實體位址）
+struct blk_iovec {
+    void *base;
+    size_t len;
+};
 
-struct file {
+// 驅動端追蹤的進行中請求
+struct blk_request {
+    struct virtio_blk_req *hdr;
+    unsigned sector;
+    unsigned nsectors;
+    int is_write;
     bool in_use;
-    char name[100];
-    char data[1024];
-    size_t size;
+    volatile bool done;
 };
 
+struct sbiret sbi_call(long arg0, long arg1, long arg2, long arg3, long arg4,
+                       long arg5, long fid, long eid);
+
+// 主控台
+void putchar(char ch);
+void console_flush(void);
+void console_panic(void);
+void uart_init(void);
+void uart_handle_irq(void);
+int console_getc(bool block);
+
 // 記憶體管理
 paddr_t alloc_pages(uint32_t n);
+paddr_t try_alloc_pages(uint32_t n);
+void free_pages(paddr_t paddr, uint32_t n);
+void mm_get_stats(struct mm_stats *stats);
 void map_page(uint32_t *table1, uint32_t vaddr, paddr_t paddr, uint32_t flags);
+void map_megapage(uint32_t *table1, uint32_t vaddr, paddr_t paddr, uint32_t flags);
+void unmap_user_pages(uint32_t *table1);
+paddr_t walk_page(uint32_t *table1, vaddr_t vaddr, uint32_t flags);
+int user_buf_to_iov(uint32_t *table1, vaddr_t vaddr, size_t len, int writable,
+                    struct blk_iovec *iov, int max);
+bool user_range_ok(uint32_t *table1, vaddr_t vaddr, size_t len, uint32_t flags);
+// 複製到目前進程的使用者記憶體，位址無效時不複製並回傳 -1
+int copy_to_user(vaddr_t dst, const void *src, size_t len);
+int strnlen_user(vaddr_t vaddr, size_t max);
+
+// 使用者緩衝區直接與磁碟 DMA（len 須為 SECTOR_SIZE 的倍數）
+int user_disk_rw(vaddr_t buf, unsigned sector, size_t len, int is_write);
+// 同上，但拒絕碰到 LLM 請求環與檔案系統的範圍（SYS_DISK_* 與 URING_OP_DISK_* 用）
+int user_raw_disk_rw(vaddr_t buf, unsigned sector, size_t len, int is_write);
+
+// 排程
+void spin_lock(struct spinlock *lock);
+void spin_unlock(struct spinlock *lock);
+void make_runnable(struct process *proc);
+void yield(void);
+uint64_t read_time(void);
+void sleep_on(struct wait_queue *wq, struct spinlock *lock);
+bool sleep_on_timeout(struct wait_queue *wq, struct spinlock *lock, uint64_t deadline);
+void wake_up(struct wait_queue *wq);
 
 #define READ_CSR(reg)                                                          \
     ({                                                                         \
@@ -176,8 +304,21 @@ void map_page(uint32_t *table1, uint32_t vaddr, paddr_t paddr, uint32_t flags);
         __asm__ __volatile__("csrw " #reg ", %0" ::"r"(__tmp));                \
     } while (0)
 
+// 核心態的 tp 指向目前 hart 的 struct cpu（handle_trap 進入時重新設定）。
+// 進程可能在 yield() 前後換到別的 hart，所以每次都要重讀，不能快取。
+#define mycpu()                                                                \
+    ({                                                                         \
+        struct cpu *__cpu;                                                     \
+        __asm__ __volatile__("mv %0, tp" : "=r"(__cpu));                       \
+        __cpu;                                                                 \
+    })
+
+#define current_proc (mycpu()->proc)
+#define idle_proc    (mycpu()->idle)
+
 #define PANIC(fmt, ...)                                                        \
     do {                                                                       \
+        console_panic();                                                       \
         printf("PANIC: %s:%d: " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__);  \
         while (1) {}                                                           \
     } while (0)
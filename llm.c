@@ -0,0 +1,624 @@
+#include "kernel.h"
+#include "common.h"
+#include "bcache.h"
+#include "virtio.h"
+#include "llm.h"
+#include "llm_cache.h"
+
+// 每個槽位目前的請求 ID（0 表示空）與送出它的進程。槽位要等回應被取回
+// （或送出者結束）才能重用，所以 host 處理得慢時送出端會看到環已滿。
+static uint32_t slot_id[LLM_RING_SLOTS];
+static int slot_pid[LLM_RING_SLOTS];
+// 磁碟傳輸時已取消（或送出者已結束）的槽位：host 可能還在寫它的回應區，
+// 要等 host 標記完成才能重用
+#define LLM_ORPHAN 0
+static uint32_t llm_epoch;
+static struct spinlock llm_lock;
+// SYS_LLM_WAIT 的等待者；console 收到回應時叫醒，磁碟傳輸則定時醒來重讀 host header
+static struct wait_queue llm_wait_queue;
+// 磁碟傳輸時重讀 host header 的間隔，從最短開始每次加倍到最長（同 host 的 wait_guest_change）
+#define LLM_WAIT_POLL_MIN_MS 2
+#define LLM_WAIT_POLL_MAX_MS 50
+// 串流讀取時依序累計的 CRC，讀完時與訊框 header 比對
+static uint32_t stream_crc[LLM_RING_SLOTS];
+static uint32_t stream_pos[LLM_RING_SLOTS];
+
+// 訊框頭尾不滿一個磁區的部分：寫入時補零，讀取時丟進 scratch（內容無意義）
+static const uint8_t llm_zero_pad[SECTOR_SIZE];
+static uint8_t llm_scratch[SECTOR_SIZE];
+
+// virtio-console 傳輸：回應直接收進核心的緩衝區，查詢不必碰磁碟。
+// 磁碟傳輸時 resp_buf 收集依序串流讀到的內容，讀完後放進快取。
+static bool llm_use_console;
+// 開機時 host 回傳了這次的 HELLO：訊框送得出去不代表另一頭有人接（socket
+// 沒連上時 QEMU 直接丟掉），收到回音才改走 console
+static bool llm_host_hello;
+#define LLM_HELLO_TIMEOUT_MS 3000
+#define LLM_HELLO_RETRY_MS   100 // host 可能在這段時間才連上，之前送的會被丟掉
+static uint32_t llm_next_id;   // 上一個配出的請求 ID
+static char resp_buf[LLM_RING_SLOTS][LLM_MAX_RESPONSE_SIZE];
+static uint32_t resp_len[LLM_RING_SLOTS];
+static bool resp_done[LLM_RING_SLOTS];
+static bool resp_nocache[LLM_RING_SLOTS]; // host 標記這則回應不可快取（錯誤或逾時）
+// 接收端的訊框解析狀態（資料可能在任意位置被切成好幾段）
+static struct llm_frame rx_frame;
+static uint32_t rx_frame_len;  // rx_frame 已收到的位元組數
+static uint32_t rx_payload_left;
+static int rx_slot;            // 內容要放進的槽位，-1 表示丟棄
+
+// 未命中快取的請求正規化後的鍵，回應完整時連同回應放進快取
+static char slot_key[LLM_RING_SLOTS][LLM_MAX_REQUEST_SIZE];
+static uint32_t slot_key_len[LLM_RING_SLOTS];
+static uint32_t slot_key_hash[LLM_RING_SLOTS];
+
+// 命中快取的請求不佔用請求環，ID 帶 LLM_CACHED_ID 位元，回應直接從 pin 住的
+// 快取項目讀。其他請求 ID 都小於這個位元（console 的 epoch 只取 14 位元）。
+#define LLM_CACHED_ID 0x40000000u
+static uint32_t hit_id[LLM_RING_SLOTS];
+static int hit_pid[LLM_RING_SLOTS];
+static struct llm_cache_entry *hit_entry[LLM_RING_SLOTS];
+static uint32_t llm_next_hit;
+
+// 重設 guest header。host 看到 epoch 改變就會丟掉上一次開機留下的狀態。
+void llm_init(void) {
+    struct buf *b = bread(LLM_GUEST_HDR_SECTOR);
+    if (!b)
+        PANIC("llm: failed to read the guest header");
+    struct llm_guest_hdr *hdr = (struct llm_guest_hdr *) b->data;
+    llm_epoch = hdr->magic == LLM_GUEST_MAGIC ? hdr->epoch + 1 : 1;
+    memset(b->data, 0, SECTOR_SIZE);
+    hdr->magic = LLM_GUEST_MAGIC;
+    hdr->epoch = llm_epoch;
+    hdr->nslots = LLM_RING_SLOTS;
+    bwrite(b);
+    brelse(b);
+
+    if (virtio_console_present()) {
+        // ID 的高位放 epoch，上一次開機還沒送完的回應不會對到這次的請求
+        llm_next_id = (llm_epoch & 0x3fff) << 16;
+        struct llm_frame hello = { LLM_FRAME_MAGIC, LLM_FRAME_HELLO, llm_epoch, 0 };
+        uint64_t start = read_time();
+        uint64_t next_send = start;
+        while (!llm_host_hello
+               && read_time() - start < LLM_HELLO_TIMEOUT_MS * (TIMER_FREQ / 1000)) {
+            if (read_time() >= next_send) {
+                virtio_console_send(&hello, sizeof(hello), NULL, 0);
+                next_send += LLM_HELLO_RETRY_MS * (TIMER_FREQ / 1000);
+            }
+            // 開機時還沒開中斷，直接呼叫中斷處理函式收資料
+            virtio_console_handle_irq();
+        }
+        llm_use_console = llm_host_hello;
+        if (!llm_use_console)
+            printf("llm: no host on virtio-console, falling back to the disk ring\n");
+    }
+    printf("llm: %d slots over %s (epoch %u)\n", LLM_RING_SLOTS,
+           llm_use_console ? "virtio-console" : "disk ring", llm_epoch);
+}
+
+// CRC-32（多項式 0xedb88320），crc 傳入前一段的結果可以分段計算，與 zlib.crc32 相同。
+// 一次查 4 位元，表只有 16 項。
+static uint32_t llm_crc32(uint32_t crc, const void *buf, size_t len) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+        0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    const uint8_t *p = buf;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 15];
+        crc = (crc >> 4) ^ table[crc & 15];
+    }
+    return ~crc;
+}
+
+// 以一個多磁區請求讀寫磁區 area 開始的訊框：hdr 不是 NULL 時從訊框開頭讀寫
+// header 與內容的前 n 個位元組；hdr 為 NULL 時只讀寫內容的 [offset, offset + n)。
+// 內容直接與使用者緩衝區 DMA，頭尾不滿一個磁區的部分另外補上。
+static int llm_msg_rw(unsigned area, struct llm_msg_hdr *hdr, uint32_t offset,
+                      vaddr_t buf, uint32_t n, bool is_write) {
+    uint32_t pos = sizeof(*hdr) + offset; // 使用者資料在訊框中的位置
+    uint32_t lead = hdr ? pos : pos % SECTOR_SIZE;
+    uint32_t tail = (SECTOR_SIZE - (pos + n) % SECTOR_SIZE) % SECTOR_SIZE;
+    uint8_t *pad = is_write ? (uint8_t *) llm_zero_pad : llm_scratch;
+
+    struct blk_iovec iov[BLK_MAX_SEGS];
+    int cnt = 0;
+    if (hdr)
+        iov[cnt++] = (struct blk_iovec) { .base = hdr, .len = lead };
+    else if (lead)
+        iov[cnt++] = (struct blk_iovec) { .base = pad, .len = lead };
+    int m = user_buf_to_iov(current_proc->page_table, buf, n, !is_write, &iov[cnt],
+                            BLK_MAX_SEGS - cnt - 1);
+    if (m < 0)
+        return -1;
+    cnt += m;
+    if (tail)
+        iov[cnt++] = (struct blk_iovec) { .base = pad, .len = tail };
+
+    unsigned sector = area + (pos - lead) / SECTOR_SIZE;
+    return is_write ? blk_writev(sector, iov, cnt) : blk_readv(sector, iov, cnt);
+}
+
+static uint32_t llm_resp_progress(int slot, uint32_t id, bool *done);
+static void llm_free_slot(int slot);
+
+// 孤兒槽位在 host 回應完畢後才釋放（guest 重開機過則 epoch 對不上，永遠不會完成，
+// 但那時槽位狀態也已經重設）
+static void llm_reclaim(int slot) {
+    bool done;
+    llm_resp_progress(slot, slot_id[slot], &done);
+    if (done)
+        llm_free_slot(slot);
+}
+
+// 記下未命中的請求的鍵；在請求送出前呼叫，回應不可能比它先到
+static void llm_remember_key(int slot, vaddr_t buf, uint32_t len) {
+    slot_key_len[slot] = llm_cache_key((const char *) buf, len, slot_key[slot],
+                                       &slot_key_hash[slot]);
+    resp_nocache[slot] = false;
+}
+
+// 完整且通過校驗的回應放進快取（host 標記不可快取的除外），要在釋放槽位前呼叫
+static void llm_cache_store(int slot, const char *resp, uint32_t len) {
+    if (!resp_nocache[slot])
+        llm_cache_insert(slot_key[slot], slot_key_len[slot], slot_key_hash[slot], resp, len);
+}
+
+// 快取命中時配一個 hit 槽位並回傳 ID；未命中或 hit 槽位用完回傳 0，照常送給 host
+static int llm_cache_submit(vaddr_t buf, uint32_t len) {
+    struct llm_cache_entry *e = llm_cache_lookup((const char *) buf, len);
+    if (!e)
+        return 0;
+
+    uint32_t id = 0;
+    spin_lock(&llm_lock);
+    for (int i = 0; i < LLM_RING_SLOTS && !id; i++) {
+        if (!hit_id[i]) {
+            id = LLM_CACHED_ID | (++llm_next_hit & (LLM_CACHED_ID - 1));
+            hit_id[i] = id;
+            hit_pid[i] = current_proc->pid;
+            hit_entry[i] = e;
+        }
+    }
+    spin_unlock(&llm_lock);
+    if (!id)
+        llm_cache_unpin(e);
+    return id;
+}
+
+// 放掉 hit 槽位與它 pin 住的快取項目
+static void llm_hit_free(int h) {
+    spin_lock(&llm_lock);
+    struct llm_cache_entry *e = hit_entry[h];
+    hit_id[h] = 0;
+    spin_unlock(&llm_lock);
+    llm_cache_unpin(e);
+}
+
+// 找出目前進程命中快取的請求 id 所在的 hit 槽位，找不到回傳 -1
+static int llm_find_hit(uint32_t id) {
+    int h = -1;
+    spin_lock(&llm_lock);
+    for (int i = 0; i < LLM_RING_SLOTS; i++) {
+        if (hit_id[i] == id && hit_pid[i] == current_proc->pid)
+            h = i;
+    }
+    spin_unlock(&llm_lock);
+    return h;
+}
+
+// 讀取命中快取的回應，回傳值與 llm_poll（stream 為 false）或 llm_stream 相同
+static int llm_hit_read(vaddr_t buf, uint32_t id, uint32_t offset, bool stream) {
+    int h = llm_find_hit(id);
+    if (h < 0)
+        return -1;
+
+    struct llm_cache_entry *e = hit_entry[h];
+    if (!stream)
+        offset = 0;
+    if (offset < e->resp_len || !stream) {
+        uint32_t n = e->resp_len - offset;
+        if (copy_to_user(buf, LLM_CACHE_RESP(e) + offset, n + 1) < 0) // 連同結尾的 NUL
+            return -1; // 項目仍然 pin 著，換個緩衝區可以再讀
+        if (stream)
+            return n;
+    }
+    llm_hit_free(h);
+    return stream ? LLM_STREAM_DONE : 1;
+}
+
+static int llm_console_submit(vaddr_t buf, uint32_t len) {
+    spin_lock(&llm_lock);
+    uint32_t id = llm_next_id + 1;
+    uint32_t slot = (id - 1) % LLM_RING_SLOTS;
+    if (slot_id[slot] != 0) {
+        spin_unlock(&llm_lock);
+        return -1;
+    }
+    llm_next_id = id;
+    slot_id[slot] = id;
+    slot_pid[slot] = current_proc->pid;
+    resp_len[slot] = 0;
+    resp_done[slot] = false;
+    stream_crc[slot] = stream_pos[slot] = 0;
+    spin_unlock(&llm_lock);
+
+    llm_remember_key(slot, buf, len);
+    struct llm_frame frame = { LLM_FRAME_MAGIC, LLM_FRAME_REQUEST, id, len };
+    if (virtio_console_send(&frame, sizeof(frame), (const void *) buf, len) < 0) {
+        spin_lock(&llm_lock);
+        slot_id[slot] = 0;
+        spin_unlock(&llm_lock);
+        return -1;
+    }
+    return id;
+}
+
+// 把使用者的請求（最多 LLM_MAX_REQUEST_SIZE - 1 個位元組）放進下一個槽位，回傳請求 ID。
+// 快取命中時不經過 host，回應立刻就能取回。請求不是使用者可讀的記憶體時回傳 -1。
+int llm_submit(vaddr_t buf) {
+    // 逐頁檢查，否則進程可以讓核心把任意的核心記憶體當成請求送給 host
+    int n = strnlen_user(buf, LLM_MAX_REQUEST_SIZE - 1);
+    if (n < 0)
+        return -1;
+    uint32_t len = n;
+    int id = llm_cache_submit(buf, len);
+    if (id)
+        return id;
+    if (llm_use_console)
+        return llm_console_submit(buf, len);
+
+    // 持有 guest header 的 buffer（BUF_BUSY）期間其他送出者會在 bget 裡等，
+    // 它同時是送出端的睡眠鎖
+    struct buf *b = bread(LLM_GUEST_HDR_SECTOR);
+    if (!b)
+        return -1;
+    struct llm_guest_hdr *hdr = (struct llm_guest_hdr *) b->data;
+    id = hdr->producer + 1;
+    uint32_t slot = hdr->producer % LLM_RING_SLOTS;
+    if (slot_id[slot] && slot_pid[slot] == LLM_ORPHAN)
+        llm_reclaim(slot);
+
+    spin_lock(&llm_lock);
+    bool busy = slot_id[slot] != 0;
+    if (!busy) {
+        slot_id[slot] = id;
+        slot_pid[slot] = current_proc->pid;
+        stream_crc[slot] = stream_pos[slot] = 0;
+    }
+    spin_unlock(&llm_lock);
+    if (busy) {
+        brelse(b);
+        return -1;
+    }
+
+    // 先寫好請求訊框再更新 producer，host 看到新的 producer 時資料一定已經在磁碟上
+    llm_remember_key(slot, buf, len);
+    struct llm_msg_hdr msg = { LLM_MSG_MAGIC, id, len, llm_crc32(0, (const void *) buf, len) };
+    if (llm_msg_rw(LLM_REQ_SECTOR(slot), &msg, 0, buf, len, true) < 0) {
+        spin_lock(&llm_lock);
+        slot_id[slot] = 0;
+        spin_unlock(&llm_lock);
+        brelse(b);
+        return -1;
+    }
+
+    hdr->req_id[slot] = id;
+    hdr->req_len[slot] = len;
+    hdr->producer = id;
+    bwrite(b);
+    brelse(b);
+    return id;
+}
+
+// 找出目前進程送出的請求 id 所在的槽位，找不到回傳 -1
+static int llm_find_slot(uint32_t id) {
+    int slot = -1;
+    spin_lock(&llm_lock);
+    for (int i = 0; i < LLM_RING_SLOTS; i++) {
+        if (id != 0 && slot_id[i] == id && slot_pid[i] == current_proc->pid)
+            slot = i;
+    }
+    spin_unlock(&llm_lock);
+    return slot;
+}
+
+static void llm_free_slot(int slot) {
+    spin_lock(&llm_lock);
+    slot_id[slot] = 0;
+    spin_unlock(&llm_lock);
+}
+
+// 讀取槽位的回應進度：回傳目前可讀的位元組數（還沒開始回應為 0），
+// *done 表示回應是否已完整。磁碟傳輸時 host header 只有 host 會改，每次都從磁碟重讀。
+static uint32_t llm_resp_progress(int slot, uint32_t id, bool *done) {
+    if (llm_use_console) {
+        spin_lock(&llm_lock);
+        uint32_t len = resp_len[slot];
+        *done = resp_done[slot];
+        spin_unlock(&llm_lock);
+        return len;
+    }
+
+    bcache_invalidate(LLM_HOST_HDR_SECTOR);
+    struct buf *b = bread(LLM_HOST_HDR_SECTOR);
+    uint32_t len = 0;
+    *done = false;
+    if (!b)
+        return 0; // 讀不到就當作還沒有進度，下次再讀
+    struct llm_host_hdr *hdr = (struct llm_host_hdr *) b->data;
+    if (hdr->magic == LLM_HOST_MAGIC && hdr->epoch == llm_epoch && hdr->resp_id[slot] == id) {
+        len = hdr->resp_len[slot];
+        *done = hdr->resp_done[slot] == id;
+        resp_nocache[slot] = (hdr->nocache >> slot) & 1;
+    }
+    brelse(b);
+    return len < LLM_MAX_RESPONSE_SIZE - 1 ? len : LLM_MAX_RESPONSE_SIZE - 1;
+}
+
+// 把回應的 [offset, offset + n) 複製到 buf 並補上結尾，buf 連同結尾都必須是
+// 使用者可寫的記憶體。n 不超過目前的進度：磁碟傳輸時 host 先寫回應內容才更新
+// resp_len，所以磁碟上至少有這麼多位元組。
+static int llm_resp_copy(int slot, vaddr_t buf, uint32_t offset, uint32_t n) {
+    if (!user_range_ok(current_proc->page_table, buf, n + 1, PAGE_U | PAGE_W))
+        return -1;
+    if (llm_use_console) {
+        // 不必持有 llm_lock：槽位屬於呼叫者，其他人不會釋放它，而 resp_buf 只會
+        // 往後附加，已經算進 resp_len（在鎖內讀到）的部分不會再變
+        memcpy((void *) buf, resp_buf[slot] + offset, n);
+    } else if (llm_msg_rw(LLM_RESP_SECTOR(slot), NULL, offset, buf, n, false) < 0) {
+        return -1;
+    }
+    ((char *) buf)[n] = '\0';
+    return 0;
+}
+
+// 比對回應訊框的 header；socket 本身可靠，只有磁碟傳輸需要檢查
+static bool llm_resp_check(int slot, const struct llm_msg_hdr *msg, uint32_t id,
+                           uint32_t len, uint32_t crc) {
+    if (msg->magic == LLM_MSG_MAGIC && msg->id == id && msg->len == len && msg->crc == crc)
+        return true;
+    printf("llm: response %u in slot %d is corrupt (len %u/%u, crc %x/%x)\n",
+           id, slot, msg->len, len, msg->crc, crc);
+    return false;
+}
+
+// 查詢請求 id 的回應；完整時複製到使用者緩衝區並釋放槽位。
+// 磁碟傳輸時 header 與內容用同一個多磁區請求讀進來，校驗失敗回傳 -1。
+int llm_poll(vaddr_t buf, uint32_t id) {
+    if (id & LLM_CACHED_ID)
+        return llm_hit_read(buf, id, 0, false);
+    int slot = llm_find_slot(id);
+    if (slot < 0)
+        return -1;
+
+    bool done;
+    uint32_t len = llm_resp_progress(slot, id, &done);
+    if (!done)
+        return 0;
+    // 緩衝區無效時保留槽位，呼叫者還可以換個緩衝區再查
+    if (!user_range_ok(current_proc->page_table, buf, len + 1, PAGE_U | PAGE_W))
+        return -1;
+
+    int ret = 1;
+    if (llm_use_console) {
+        llm_resp_copy(slot, buf, 0, len);
+    } else {
+        struct llm_msg_hdr msg;
+        if (llm_msg_rw(LLM_RESP_SECTOR(slot), &msg, 0, buf, len, false) < 0
+            || !llm_resp_check(slot, &msg, id, len, llm_crc32(0, (const void *) buf, len)))
+            ret = -1;
+        else
+            ((char *) buf)[len] = '\0';
+    }
+    if (ret == 1)
+        llm_cache_store(slot, (const char *) buf, len);
+    llm_free_slot(slot);
+    return ret;
+}
+
+// 串流讀取：把回應中 offset 之後新寫入的位元組複製到 buf 開頭（以 NUL 結尾），
+// 回傳新位元組數，還沒有新內容回傳 0。回應完整且已全部讀完時釋放槽位並回傳
+// LLM_STREAM_DONE；ID 無效或校驗失敗回傳 -1。只有依序讀完整段時才能校驗。
+int llm_stream(vaddr_t buf, uint32_t id, uint32_t offset) {
+    if (id & LLM_CACHED_ID)
+        return llm_hit_read(buf, id, offset, true);
+    int slot = llm_find_slot(id);
+    if (slot < 0)
+        return -1;
+
+    bool done;
+    uint32_t len = llm_resp_progress(slot, id, &done);
+    if (offset >= len) {
+        if (!done)
+            return 0;
+        int ret = LLM_STREAM_DONE;
+        if (!llm_use_console && stream_pos[slot] == len) {
+            struct llm_msg_hdr msg;
+            if (llm_msg_rw(LLM_RESP_SECTOR(slot), &msg, 0, 0, 0, false) < 0
+                || !llm_resp_check(slot, &msg, id, len, stream_crc[slot]))
+                ret = -1;
+        }
+        if (ret == LLM_STREAM_DONE && stream_pos[slot] == len)
+            llm_cache_store(slot, resp_buf[slot], len);
+        llm_free_slot(slot);
+        return ret;
+    }
+
+    uint32_t n = len - offset;
+    if (llm_resp_copy(slot, buf, offset, n) < 0)
+        return -1;
+    if (stream_pos[slot] == offset) {
+        stream_crc[slot] = llm_crc32(stream_crc[slot], (const void *) buf, n);
+        stream_pos[slot] += n;
+        if (!llm_use_console)
+            memcpy(resp_buf[slot] + offset, (const void *) buf, n);
+    }
+    return n;
+}
+
+// 讓呼叫者睡到請求 id 的回應超過 offset 個位元組（或已完整），最多 timeout_ms 毫秒。
+// 有新進度回傳 1，逾時回傳 0，ID 無效回傳 -1。console 傳輸時收到訊框就會被叫醒；
+// 磁碟傳輸沒有通知，定時重讀 host header（間隔逐次加倍到 LLM_WAIT_POLL_MAX_MS），
+// 期間 hart 可以 idle。
+int llm_wait(uint32_t id, uint32_t offset, uint32_t timeout_ms) {
+    if (id & LLM_CACHED_ID)
+        return llm_find_hit(id) >= 0 ? 1 : -1;
+    int slot = llm_find_slot(id);
+    if (slot < 0)
+        return -1;
+
+    uint64_t deadline = read_time() + (uint64_t) timeout_ms * (TIMER_FREQ / 1000);
+    uint32_t poll_ms = LLM_WAIT_POLL_MIN_MS;
+    for (;;) {
+        bool done;
+        if (llm_resp_progress(slot, id, &done) > offset || done)
+            return 1;
+        uint64_t now = read_time();
+        if (now >= deadline)
+            return 0;
+        if (llm_use_console) {
+            // 持有 llm_lock 再檢查一次，llm_console_receive 改進度時也持有它，不會漏掉喚醒
+            spin_lock(&llm_lock);
+            if (resp_len[slot] <= offset && !resp_done[slot])
+                sleep_on_timeout(&llm_wait_queue, &llm_lock, deadline);
+            spin_unlock(&llm_lock);
+        } else {
+            uint64_t next = now + (uint64_t) poll_ms * (TIMER_FREQ / 1000);
+            sleep_on_timeout(&llm_wait_queue, NULL, next < deadline ? next : deadline);
+            poll_ms = poll_ms * 2 < LLM_WAIT_POLL_MAX_MS ? poll_ms * 2 : LLM_WAIT_POLL_MAX_MS;
+        }
+    }
+}
+
+// 取消請求 id，之後這個 ID 就失效。console 傳輸時通知 host 停止產生，晚到的訊框
+// 對不到槽位會被丟掉；磁碟傳輸時在 guest header 標記，槽位等 host 結束後才重用。
+int llm_cancel(uint32_t id) {
+    if (id & LLM_CACHED_ID) {
+        int h = llm_find_hit(id);
+        if (h < 0)
+            return -1;
+        llm_hit_free(h);
+        return 0;
+    }
+    int slot = llm_find_slot(id);
+    if (slot < 0)
+        return -1;
+
+    if (llm_use_console) {
+        llm_free_slot(slot);
+        struct llm_frame frame = { LLM_FRAME_MAGIC, LLM_FRAME_CANCEL, id, 0 };
+        virtio_console_send(&frame, sizeof(frame), NULL, 0);
+        return 0;
+    }
+
+    spin_lock(&llm_lock);
+    slot_pid[slot] = LLM_ORPHAN;
+    spin_unlock(&llm_lock);
+    // 讀不到 guest header 就沒辦法通知 host，槽位照樣等 host 寫完才重用
+    struct buf *b = bread(LLM_GUEST_HDR_SECTOR);
+    if (b) {
+        ((struct llm_guest_hdr *) b->data)->cancel_id[slot] = id;
+        bwrite(b);
+        brelse(b);
+    }
+    return 0;
+}
+
+// 訊框的 header 收齊了：找出內容要放的槽位（只收還在等回應的請求）
+static void llm_frame_begin(void) {
+    rx_slot = -1;
+    rx_payload_left = rx_frame.len;
+    if (rx_frame.type == LLM_FRAME_HELLO) {
+        llm_host_hello |= rx_frame.id == llm_epoch;
+        return;
+    }
+    for (int i = 0; i < LLM_RING_SLOTS; i++) {
+        if (slot_id[i] && slot_id[i] == rx_frame.id)
+            rx_slot = i;
+    }
+    if (rx_slot >= 0 && (rx_frame.type == LLM_FRAME_END
+                         || rx_frame.type == LLM_FRAME_END_NOCACHE)) {
+        resp_done[rx_slot] = true;
+        resp_nocache[rx_slot] = rx_frame.type == LLM_FRAME_END_NOCACHE;
+    }
+}
+
+// virtio-console 收到資料時由驅動程式呼叫（持有 vcon_lock）
+void llm_console_receive(const uint8_t *data, uint32_t len) {
+    bool progress = false;
+    spin_lock(&llm_lock);
+    while (len > 0) {
+        if (rx_frame_len < sizeof(rx_frame)) {
+            ((uint8_t *) &rx_frame)[rx_frame_len++] = *data++;
+            len--;
+            if (rx_frame_len < sizeof(rx_frame))
+                continue;
+            if (rx_frame.magic != LLM_FRAME_MAGIC) {
+                // 失去同步：丟掉第一個位元組，繼續找 magic
+                uint8_t *p = (uint8_t *) &rx_frame;
+                for (uint32_t i = 1; i < sizeof(rx_frame); i++)
+                    p[i - 1] = p[i];
+                rx_frame_len--;
+                continue;
+            }
+            llm_frame_begin();
+            progress |= rx_slot >= 0 && rx_frame.type != LLM_FRAME_CHUNK; // 回應結束
+        } else {
+            uint32_t n = len < rx_payload_left ? len : rx_payload_left;
+            if (rx_slot >= 0 && rx_frame.type == LLM_FRAME_CHUNK) {
+                // 超過一個訊息大小的部分丟掉
+                uint32_t room = LLM_MAX_RESPONSE_SIZE - 1 - resp_len[rx_slot];
+                uint32_t m = n < room ? n : room;
+                memcpy(resp_buf[rx_slot] + resp_len[rx_slot], data, m);
+                resp_len[rx_slot] += m;
+                progress |= m > 0;
+            }
+            data += n;
+            len -= n;
+            rx_payload_left -= n;
+        }
+        if (rx_payload_left == 0)
+            rx_frame_len = 0; // 整個訊框收完，下一個位元組是新的 header
+    }
+    if (progress)
+        wake_up(&llm_wait_queue);
+    spin_unlock(&llm_lock);
+}
+
+// 進程結束時放掉它還沒取回的槽位，免得整個環卡住（磁碟傳輸時交給 host 寫完）
+void llm_release(int pid) {
+    spin_lock(&llm_lock);
+    for (int i = 0; i < LLM_RING_SLOTS; i++) {
+        if (slot_id[i] && slot_pid[i] == pid) {
+            if (llm_use_console)
+                slot_id[i] = 0;
+            else
+                slot_pid[i] = LLM_ORPHAN;
+        }
+        if (hit_id[i] && hit_pid[i] == pid) {
+            hit_id[i] = 0;
+            llm_cache_unpin(hit_entry[i]);
+        }
+    }
+    spin_unlock(&llm_lock);
+}
+
+// 模擬 LLM 回應（暫時使用）
+void llm_simulate_response(const char *input, char *response) {
+    if (strstr(input, "你好") || strstr(input, "hello")) {
+        strcpy(response, "你好！我是基於 RISC-V OS 的 AI 助手。");
+    } else if (strstr(input, "幫助") || strstr(input, "help")) {
+        strcpy(response, "我可以幫助你了解這個作業系統，或者回答一些基本問題。");
+    } else if (strstr(input, "系統") || strstr(input, "system")) {
+        strcpy(response, "這是一個 RISC-V 32位元作業系統，支援多工處理、虛擬記憶體和檔案系統。");
+    } else if (strstr(input, "謝謝") || strstr(input, "thank")) {
+        strcpy(response, "不客氣！還有什麼我可以幫助你的嗎？");
+    } else {
+        strcpy(response, "我理解你的輸入，這很有趣！請告訴我更多。");
+    }
+}
+
@@ -0,0 +1,82 @@
+#pragma once
+#include "common.h"
+
+// guest 與 host 之間的 LLM 請求環（磁碟格式與 llm_ring.py 對應）。
+// 兩個 header 各自只有一方會寫：guest 寫 producer，host 寫 consumer。
+// 請求依 producer 順序放進槽位 (id - 1) % LLM_RING_SLOTS；host 可能並行處理，
+// 各槽位完成的先後不一定，guest 只看自己槽位的 resp_id/resp_done。
+// 回應可以串流：host 先寫入回應的內容，再把 resp_len 往上加（只增不減），
+// 整段寫完、訊框 header 也寫好後才設 resp_done。
+#define LLM_RING_SLOTS        8
+#define LLM_GUEST_HDR_SECTOR  0 // guest 寫、host 讀
+#define LLM_HOST_HDR_SECTOR   1 // host 寫、guest 讀
+#define LLM_SLOT_BASE_SECTOR  2 // 之後每個槽位依序是請求區與回應區
+
+// 請求與回應在磁碟上都是一個訊框：llm_msg_hdr 後面緊接 len 個位元組的內容，
+// 佔用連續的磁區，整則訊息用一個多磁區的 virtio 請求讀寫。
+#define LLM_MSG_MAGIC 0x4d4d4c4c // "LLMM"
+
+struct llm_msg_hdr {
+    uint32_t magic;
+    uint32_t id;  // 所屬的請求 ID，防止讀到槽位上一次的內容
+    uint32_t len; // 內容的位元組數（不含結尾）
+    uint32_t crc; // 內容的 CRC-32（與 zlib.crc32 相同）
+};
+
+#define LLM_MSG_SECTORS(size) \
+    ((sizeof(struct llm_msg_hdr) + (size) + SECTOR_SIZE - 1) / SECTOR_SIZE)
+#define LLM_REQ_SECTORS       LLM_MSG_SECTORS(LLM_MAX_REQUEST_SIZE)
+#define LLM_RESP_SECTORS      LLM_MSG_SECTORS(LLM_MAX_RESPONSE_SIZE)
+#define LLM_SLOT_SECTORS      (LLM_REQ_SECTORS + LLM_RESP_SECTORS)
+#define LLM_REQ_SECTOR(slot)  (LLM_SLOT_BASE_SECTOR + (slot) * LLM_SLOT_SECTORS)
+#define LLM_RESP_SECTOR(slot) (LLM_REQ_SECTOR(slot) + LLM_REQ_SECTORS)
+
+#define LLM_GUEST_MAGIC 0x474d4c4c // "LLMG"
+#define LLM_HOST_MAGIC  0x484d4c4c // "LLMH"
+
+struct llm_guest_hdr {
+    uint32_t magic;
+    uint32_t epoch;    // 每次開機加一，host 看到改變就重設自己的狀態
+    uint32_t nslots;
+    uint32_t producer; // 已送出的請求數；請求 ID 從 1 開始連號
+    uint32_t req_id[LLM_RING_SLOTS];
+    uint32_t req_len[LLM_RING_SLOTS];
+    uint32_t cancel_id[LLM_RING_SLOTS]; // guest 已取消的請求 ID，host 看到就提早結束回應
+};
+
+struct llm_host_hdr {
+    uint32_t magic;
+    uint32_t epoch;    // 這份狀態對應的 guest epoch
+    uint32_t consumer; // 此 ID 以前（含）的請求都已回應完畢
+    uint32_t nocache;  // 位元 slot：該槽位的回應不可快取（錯誤或逾時）
+    uint32_t resp_id[LLM_RING_SLOTS];   // 正在（或已經）回應的請求 ID
+    uint32_t resp_len[LLM_RING_SLOTS];  // 目前寫入回應磁區的位元組數
+    uint32_t resp_done[LLM_RING_SLOTS]; // 回應已完整的請求 ID
+};
+
+// 接了 virtio-console 時改用訊框在 socket 上傳送，不再輪詢磁碟。
+// 每個訊框是一個 header 加上 len 個位元組的內容（格式與 llm_ring.py 對應）。
+#define LLM_FRAME_MAGIC 0x464d4c4c // "LLMF"
+#define LLM_FRAME_HELLO   1 // guest -> host，id 為 epoch，開機時送出；host 原樣送回
+#define LLM_FRAME_REQUEST 2 // guest -> host，內容為請求文字
+#define LLM_FRAME_CHUNK   3 // host -> guest，回應的下一段
+#define LLM_FRAME_END     4 // host -> guest，回應結束
+#define LLM_FRAME_END_NOCACHE 5 // host -> guest，回應結束，但內容不可快取
+#define LLM_FRAME_CANCEL  6 // guest -> host，取消請求 id
+
+struct llm_frame {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t id;
+    uint32_t len;
+};
+
+void llm_init(void);
+int llm_submit(vaddr_t buf);
+int llm_poll(vaddr_t buf, uint32_t id);
+int llm_stream(vaddr_t buf, uint32_t id, uint32_t offset);
+int llm_wait(uint32_t id, uint32_t offset, uint32_t timeout_ms);
+int llm_cancel(uint32_t id);
+void llm_release(int pid);
+void llm_console_receive(const uint8_t *data, uint32_t len);
+void llm_simulate_response(const char *input, char *response);
@@ -0,0 +1,90 @@
+"""
+Host 端 LLM 服務的後端
+
+後端只需要實作 stream(request)，以字串片段逐段產生回應；服務本身負責
+並行、逾時與寫回 guest。stream() 會在多個 worker 執行緒中同時被呼叫。
+錯誤訊息以 ErrorText 產生，guest 就不會把這則回應放進快取。
+"""
+
+import os
+import time
+from typing import Iterator
+
+try:
+    import openai
+except ImportError:  # 只用 stub 時不需要 openai 套件
+    openai = None
+
+
+class ErrorText(str):
+    """錯誤訊息：照常送給 guest，但整則回應標記為不可快取"""
+
+
+class Backend:
+    name = "base"
+
+    def stream(self, request: str) -> Iterator[str]:
+        raise NotImplementedError
+
+
+class OpenAIBackend(Backend):
+    """只呼叫新版 OpenAI API（串流模式），失敗就顯示錯誤，不再有模擬回應"""
+    name = "openai"
+
+    def __init__(self, model: str = "gpt-3.5-turbo", timeout: float = 60.0):
+        self.model = model
+        self.timeout = timeout
+        self.api_key = os.getenv("OPENAI_API_KEY")
+        # client 內部的 HTTP 連線池可以跨執行緒共用
+        self.client = openai.OpenAI(api_key=self.api_key) if openai and self.api_key else None
+
+    def stream(self, request: str) -> Iterator[str]:
+        if not self.client:
+            yield ErrorText("[錯誤] OpenAI API 未正確設定，請確認已安裝 openai 套件並設置 OPENAI_API_KEY。")
+            return
+        try:
+            stream = self.client.chat.completions.create(
+                model=self.model,
+                messages=[
+                    {"role": "system", "content": "你是 RISC-V OS 的 AI 助手，請用繁體中文回答。"},
+                    {"role": "user", "content": request}
+                ],
+                max_tokens=4096,
+                temperature=0.7,
+                stream=True,
+                timeout=self.timeout
+            )
+            for chunk in stream:
+                if chunk.choices and chunk.choices[0].delta.content:
+                    yield chunk.choices[0].delta.content
+        except Exception as e:
+            yield ErrorText(f"[OpenAI API 錯誤] {e}")
+
+
+class StubBackend(Backend):
+    """離線、可重現的假後端：回覆只由請求內容決定。先等 latency 秒（模擬
+    第一個 token 的延遲），之後每隔 interval 秒送出一段，用來測試串流與吞吐量。"""
+    name = "stub"
+
+    CHUNK_CHARS = 4  # 短回覆時每段的字元數；長回覆最多切成 50 段
+
+    def __init__(self, latency: float = 0.0, interval: float = 0.2, min_bytes: int = 0):
+        self.latency = latency
+        self.interval = interval
+        self.min_bytes = min_bytes
+
+    def reply(self, request: str) -> str:
+        reply = f"（stub）收到你的訊息「{request}」。這段回覆會分成好幾段慢慢送出，用來測試串流。"
+        line = 1
+        while len(reply.encode('utf-8')) < self.min_bytes:  # 測試跨多個磁區的長回應
+            reply += f"\n第 {line} 行：填充文字，用來測試超過一個磁區的回應。"
+            line += 1
+        return reply
+
+    def stream(self, request: str) -> Iterator[str]:
+        reply = self.reply(request)
+        time.sleep(self.latency)
+        step = max(self.CHUNK_CHARS, len(reply) // 50)
+        for i in range(0, len(reply), step):
+            time.sleep(self.interval)
+            yield reply[i:i + step]
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""
+LLM host 服務的吞吐量測試（不需要 QEMU 與 OpenAI）
+
+在暫存的映像檔上扮演 guest：照 kernel 的規則把請求寫進請求環（最多
+RING_SLOTS 個同時在等），另外啟動 llm_host_service.py --stub，量測不同
+worker 數下每秒完成的請求數，並檢查每個回應的訊框 CRC。
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+from llm_ring import (DISK_SECTORS, GUEST_HDR_SECTOR, GUEST_MAGIC, MAX_REQUEST_SIZE,
+                      MAX_RESPONSE_SIZE, RING_SLOTS, SECTOR_SIZE, GuestHeader, RingDisk,
+                      req_sector, resp_sector, slot_of)
+
+
+class FakeGuest:
+    def __init__(self, disk: RingDisk, epoch: int):
+        self.disk = disk
+        self.hdr = GuestHeader(GUEST_MAGIC, epoch, RING_SLOTS, 0)
+
+    def submit(self, text: str) -> int:
+        request_id = self.hdr.producer + 1
+        slot = slot_of(request_id)
+        length = self.disk.write_text(req_sector(slot), request_id, text, MAX_REQUEST_SIZE)
+        self.hdr.req_id[slot] = request_id
+        self.hdr.req_len[slot] = length
+        self.hdr.producer = request_id
+        self.disk.write_sector(GUEST_HDR_SECTOR, self.hdr.pack())
+        return request_id
+
+    def done(self, request_id: int) -> bool:
+        host = self.disk.read_host_header()
+        return (host.epoch == self.hdr.epoch
+                and host.resp_done[slot_of(request_id)] == request_id)
+
+    def response(self, request_id: int) -> str:
+        return self.disk.read_text(resp_sector(slot_of(request_id)), request_id,
+                                   MAX_RESPONSE_SIZE)
+
+
+def run(workers: int, requests: int, args) -> float:
+    """回傳每秒完成的請求數"""
+    with tempfile.NamedTemporaryFile(suffix=".img", delete=False) as f:
+        f.truncate(DISK_SECTORS * SECTOR_SIZE)
+        image = f.name
+    service = subprocess.Popen(
+        [sys.executable, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                      "llm_host_service.py"),
+         "--disk", image, "--stub", "--workers", str(workers), "--timeout", "0",
+         "--stub-latency", str(args.latency), "--stub-interval", str(args.interval)],
+        stdout=subprocess.DEVNULL)
+    disk = RingDisk(image)
+    try:
+        guest = FakeGuest(disk, epoch=1)
+        pending = []
+        submitted = 0
+        start = time.monotonic()
+        while submitted < requests or pending:
+            # 與 kernel 相同：槽位的上一個請求讀完回應之前不能重用
+            while submitted < requests and len(pending) < RING_SLOTS:
+                pending.append(guest.submit(f"測試請求 {submitted + 1}"))
+                submitted += 1
+            for request_id in [r for r in pending if guest.done(r)]:
+                reply = guest.response(request_id)  # CRC 不符會丟出 ValueError
+                if f"測試請求 {request_id}」" not in reply:
+                    raise RuntimeError(f"請求 #{request_id} 的回應不對：{reply}")
+                pending.remove(request_id)
+            time.sleep(0.001)
+        return requests / (time.monotonic() - start)
+    finally:
+        service.terminate()
+        service.wait()
+        disk.close()
+        os.unlink(image)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="量測 llm_host_service.py 的並行吞吐量")
+    parser.add_argument("--requests", type=int, default=32, help="每一輪送出的請求數")
+    parser.add_argument("--workers", default="1,2,4,8", help="要測試的 worker 數，以逗號分隔")
+    parser.add_argument("--latency", type=float, default=0.1, help="stub 第一段的延遲秒數")
+    parser.add_argument("--interval", type=float, default=0.01, help="stub 每段之間的秒數")
+    args = parser.parse_args()
+
+    print(f"stub：延遲 {args.latency} 秒，每段間隔 {args.interval} 秒，"
+          f"每輪 {args.requests} 個請求")
+    base = None
+    for workers in [int(w) for w in args.workers.split(",")]:
+        rate = run(workers, args.requests, args)
+        base = base or rate
+        print(f"workers={workers:2d}  {rate:7.2f} 請求/秒  （{rate / base:.2f}x）")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,250 @@
+#include "kernel.h"
+#include "common.h"
+#include "llm_cache.h"
+
+// LLM 回應快取：雜湊索引 + LRU 淘汰（與 bcache 相同的做法）。
+// 命中的請求在讀完回應前會 pin 住項目，淘汰時跳過，避免內容被釋放。
+static struct llm_cache_entry entries[LLM_CACHE_ENTRIES];
+static struct llm_cache_entry *buckets[LLM_CACHE_NBUCKET];
+static struct llm_cache_entry *lru_head, *lru_tail;
+static uint32_t pages_used;     // 含已移除但還有人在讀的項目
+static uint32_t ttl_seconds;    // 0 表示不過期
+static struct llm_cache_stats stats;
+// 保護上面全部；呼叫者可以持有 llm_lock（順序為 llm_lock -> llm_cache_lock）
+static struct spinlock llm_cache_lock;
+
+// alloc_pages(n) 實際配置的頁數（向上取 2 的冪次）
+static uint32_t block_pages(uint32_t n) {
+    uint32_t pages = 1;
+    while (pages < n)
+        pages <<= 1;
+    return pages;
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// 正規化請求文字：去掉頭尾空白、連續的空白視為一個空格、ASCII 轉小寫。
+// 逐字元產生，比對使用者緩衝區時不必先複製一份。
+struct key_iter {
+    const char *s;
+    uint32_t len;
+    uint32_t i;
+    bool started; // 已經產生過非空白字元
+    bool pending; // 中間有空白還沒輸出
+};
+
+static int key_next(struct key_iter *it) {
+    while (it->i < it->len) {
+        char c = it->s[it->i];
+        if (is_space(c)) {
+            it->pending = it->started;
+            it->i++;
+            continue;
+        }
+        if (it->pending) {
+            it->pending = false;
+            return ' ';
+        }
+        it->i++;
+        it->started = true;
+        return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : (uint8_t) c;
+    }
+    return -1;
+}
+
+// 算出 prompt 的鍵（key 不是 NULL 時寫入，最多 len 個位元組）與它的 FNV-1a 雜湊，
+// 回傳鍵的長度
+uint32_t llm_cache_key(const char *prompt, uint32_t len, char *key, uint32_t *hash) {
+    struct key_iter it = { prompt, len, 0, false, false };
+    uint32_t h = 2166136261u, n = 0;
+    int c;
+    while ((c = key_next(&it)) >= 0) {
+        h = (h ^ (uint8_t) c) * 16777619u;
+        if (key)
+            key[n] = c;
+        n++;
+    }
+    *hash = h;
+    return n;
+}
+
+static bool key_equal(const struct llm_cache_entry *e, const char *prompt, uint32_t len) {
+    struct key_iter it = { prompt, len, 0, false, false };
+    for (uint32_t i = 0; i < e->key_len; i++) {
+        if (key_next(&it) != (uint8_t) e->data[i])
+            return false;
+    }
+    return key_next(&it) < 0;
+}
+
+static void lru_remove(struct llm_cache_entry *e) {
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(struct llm_cache_entry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = lru_head;
+    if (lru_head)
+        lru_head->lru_prev = e;
+    else
+        lru_tail = e;
+    lru_head = e;
+}
+
+static void hash_remove(struct llm_cache_entry *e) {
+    struct llm_cache_entry **p = &buckets[e->hash % LLM_CACHE_NBUCKET];
+    while (*p && *p != e)
+        p = &(*p)->hash_next;
+    if (*p)
+        *p = e->hash_next;
+    e->hash_next = NULL;
+}
+
+static void hash_insert(struct llm_cache_entry *e) {
+    struct llm_cache_entry **bucket = &buckets[e->hash % LLM_CACHE_NBUCKET];
+    e->hash_next = *bucket;
+    *bucket = e;
+}
+
+// 呼叫者持有 llm_cache_lock
+static void entry_free(struct llm_cache_entry *e) {
+    free_pages((paddr_t) e->data, e->pages);
+    pages_used -= block_pages(e->pages);
+    e->data = NULL;
+}
+
+// 從表中移除；還有人在讀的話等最後一個 llm_cache_unpin 再釋放。呼叫者持有 llm_cache_lock
+static void entry_unlink(struct llm_cache_entry *e) {
+    hash_remove(e);
+    lru_remove(e);
+    e->linked = false;
+    stats.entries--;
+    if (e->refs == 0)
+        entry_free(e);
+}
+
+static bool entry_expired(const struct llm_cache_entry *e) {
+    return e->expires && read_time() >= e->expires;
+}
+
+// 找 prompt 的快取回應；命中時回傳已 pin 住的項目，讀完要呼叫 llm_cache_unpin
+struct llm_cache_entry *llm_cache_lookup(const char *prompt, uint32_t len) {
+    uint32_t hash;
+    llm_cache_key(prompt, len, NULL, &hash);
+
+    spin_lock(&llm_cache_lock);
+    struct llm_cache_entry *e = buckets[hash % LLM_CACHE_NBUCKET];
+    while (e && !(e->hash == hash && key_equal(e, prompt, len)))
+        e = e->hash_next;
+    if (e && entry_expired(e)) {
+        entry_unlink(e);
+        stats.expired++;
+        e = NULL;
+    }
+    if (e) {
+        e->refs++;
+        lru_remove(e);
+        lru_push_front(e);
+        stats.hits++;
+    } else {
+        stats.misses++;
+    }
+    spin_unlock(&llm_cache_lock);
+    return e;
+}
+
+void llm_cache_unpin(struct llm_cache_entry *e) {
+    spin_lock(&llm_cache_lock);
+    if (--e->refs == 0 && !e->linked)
+        entry_free(e);
+    spin_unlock(&llm_cache_lock);
+}
+
+// 放入一則完整的回應（內容會複製一份）。同一個鍵已經存在時取代舊的；
+// 空間不夠就從 LRU 尾端淘汰沒有被 pin 住的項目，還是不夠就不快取。
+// 系統記憶體不足時也不快取：快取可有可無，不能為了它 PANIC。
+void llm_cache_insert(const char *key, uint32_t key_len, uint32_t hash,
+                      const char *resp, uint32_t resp_len) {
+    uint32_t pages = align_up(key_len + resp_len + 2, PAGE_SIZE) / PAGE_SIZE;
+    if (key_len == 0 || block_pages(pages) > LLM_CACHE_BUDGET_PAGES)
+        return;
+    // 在鎖外配置並複製
+    char *data = (char *) try_alloc_pages(pages);
+    if (!data)
+        return;
+    memcpy(data, key, key_len);
+    memcpy(data + key_len + 1, resp, resp_len); // try_alloc_pages 已清零，兩個 NUL 都在
+
+    spin_lock(&llm_cache_lock);
+    for (struct llm_cache_entry *e = buckets[hash % LLM_CACHE_NBUCKET]; e; e = e->hash_next) {
+        if (e->hash == hash && key_equal(e, key, key_len)) {
+            entry_unlink(e);
+            break;
+        }
+    }
+
+    struct llm_cache_entry *slot = NULL;
+    for (;;) {
+        for (int i = 0; i < LLM_CACHE_ENTRIES && !slot; i++) {
+            if (!entries[i].data)
+                slot = &entries[i];
+        }
+        if (slot && pages_used + block_pages(pages) <= LLM_CACHE_BUDGET_PAGES)
+            break;
+        struct llm_cache_entry *victim = lru_tail;
+        while (victim && victim->refs > 0)
+            victim = victim->lru_prev;
+        if (!victim) { // 全部都有人在讀
+            spin_unlock(&llm_cache_lock);
+            free_pages((paddr_t) data, pages);
+            return;
+        }
+        entry_unlink(victim); // refs 為 0，項目立刻空出來
+        stats.evictions++;
+        if (!slot)
+            slot = victim;
+    }
+
+    slot->data = data;
+    slot->pages = pages;
+    slot->hash = hash;
+    slot->key_len = key_len;
+    slot->resp_len = resp_len;
+    slot->refs = 0;
+    slot->linked = true;
+    slot->expires = ttl_seconds ? read_time() + (uint64_t) ttl_seconds * TIMER_FREQ : 0;
+    pages_used += block_pages(pages);
+    hash_insert(slot);
+    lru_push_front(slot);
+    stats.entries++;
+    stats.insertions++;
+    spin_unlock(&llm_cache_lock);
+}
+
+// 設定之後放入的項目要保留幾秒（0 表示不過期），seconds < 0 只查詢。回傳原本的值
+int llm_cache_set_ttl(int seconds) {
+    spin_lock(&llm_cache_lock);
+    int old = ttl_seconds;
+    if (seconds >= 0)
+        ttl_seconds = seconds;
+    spin_unlock(&llm_cache_lock);
+    return old;
+}
+
+void llm_cache_get_stats(struct llm_cache_stats *out) {
+    spin_lock(&llm_cache_lock);
+    *out = stats;
+    out->pages = pages_used;
+    out->ttl = ttl_seconds;
+    spin_unlock(&llm_cache_lock);
+}
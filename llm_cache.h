@@ -0,0 +1,32 @@
+#pragma once
+#include "common.h"
+
+// LLM 回應快取：以正規化後的請求文字為鍵，命中時 SYS_LLM_SEND_REQUEST 直接
+// 完成，不經過 host。內容放在 alloc_pages 配置的頁面，總量受預算限制。
+#define LLM_CACHE_ENTRIES      64
+#define LLM_CACHE_NBUCKET      31
+#define LLM_CACHE_BUDGET_PAGES 64 // 所有項目合計最多佔用的頁數（256KB）
+
+struct llm_cache_entry {
+    uint32_t hash;
+    uint32_t key_len;
+    uint32_t resp_len;
+    uint32_t pages;    // data 佔用的頁數（傳給 alloc_pages 的 n）
+    uint64_t expires;  // read_time()，0 表示不過期
+    int refs;          // 還在讀取它的命中請求數，大於 0 時不會被釋放
+    bool linked;       // 還在雜湊表與 LRU 裡；移除時若有人在讀，等 refs 歸零才釋放
+    char *data;        // 鍵、NUL、回應、NUL；NULL 表示這個項目沒有在用
+    struct llm_cache_entry *hash_next;
+    struct llm_cache_entry *lru_prev; // LRU 串列，head 為最近使用
+    struct llm_cache_entry *lru_next;
+};
+
+#define LLM_CACHE_RESP(e) ((e)->data + (e)->key_len + 1)
+
+uint32_t llm_cache_key(const char *prompt, uint32_t len, char *key, uint32_t *hash);
+struct llm_cache_entry *llm_cache_lookup(const char *prompt, uint32_t len);
+void llm_cache_unpin(struct llm_cache_entry *e);
+void llm_cache_insert(const char *key, uint32_t key_len, uint32_t hash,
+                      const char *resp, uint32_t resp_len);
+int llm_cache_set_ttl(int seconds);
+void llm_cache_get_stats(struct llm_cache_stats *stats);
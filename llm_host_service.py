@@ -1,127 +1,194 @@
 #!/usr/bin/env python3
 """
 Host 端 LLM 服務
-監控 lorem.txt 的 sector 變化，與 OS 進行 LLM 對話
+輪詢 lorem.txt 上的請求環（格式見 llm_ring.py），把 OS 端的請求依序分派給
+worker 執行緒並行處理，每個回應完成就寫回；加上 --socket 時改在 virtio-console
+的 UNIX socket 上以訊框交換，不再輪詢。後端見 llm_backends.py
 """
 
-import os
+import argparse
+import queue
+import threading
 import time
-import struct
-from typing import Optional
-import openai
+from concurrent.futures import ThreadPoolExecutor
+from typing import Iterator
 
-SECTOR_SIZE = 512
+from llm_backends import Backend, ErrorText, OpenAIBackend, StubBackend
+from llm_ring import (FRAME_CANCEL, FRAME_CHUNK, FRAME_END, FRAME_END_NOCACHE, FRAME_HELLO,
+                      FRAME_REQUEST,
+                      MAX_REQUEST_SIZE, MAX_RESPONSE_SIZE, RING_SLOTS, FrameSocket, HostHeader, RingDisk,
+                      req_sector, resp_sector, slot_of, utf8_prefix)
 
 class LLMHostService:
-    def __init__(self, disk_file="lorem.txt"):
+    def __init__(self, backend: Backend, disk_file="lorem.txt", workers=4, timeout=None):
+        self.disk = None  # 磁碟模式才映射映像檔
         self.disk_file = disk_file
-        self.last_status = ""
-        self.openai_api_key = os.getenv("OPENAI_API_KEY")
-
-    def read_sector(self, sector_num: int) -> bytes:
-        """讀取指定 sector 的內容"""
-        with open(self.disk_file, 'rb') as f:
-            f.seek(sector_num * SECTOR_SIZE)
-            return f.read(SECTOR_SIZE)
-
-    def write_sector(self, sector_num: int, data: bytes):
-        """寫入資料到指定 sector"""
-        # 確保資料長度是 SECTOR_SIZE
-        if len(data) > SECTOR_SIZE:
-            data = data[:SECTOR_SIZE]
-        elif len(data) < SECTOR_SIZE:
-            data = data.ljust(SECTOR_SIZE, b'\x00')
-
-        with open(self.disk_file, 'r+b') as f:
-            f.seek(sector_num * SECTOR_SIZE)
-            f.write(data)
-            f.flush()
-
-    def get_status(self) -> str:
-        """讀取狀態檔案 (sector 2)"""
-        data = self.read_sector(2)
-        # 找到第一個 null byte
-        null_pos = data.find(b'\x00')
-        if null_pos == -1:
-            null_pos = len(data)
-        return data[:null_pos].decode('utf-8', errors='ignore')
-
-    def get_request(self) -> str:
-        """讀取請求檔案 (sector 0)"""
-        data = self.read_sector(0)
-        # 找到第一個 null byte
-        null_pos = data.find(b'\x00')
-        if null_pos == -1:
-            null_pos = len(data)
-        return data[:null_pos].decode('utf-8', errors='ignore')
-
-    def set_response(self, response: str):
-        """寫入回應檔案 (sector 1)"""
-        self.write_sector(1, response.encode('utf-8'))
-
-    def set_status(self, status: str):
-        """寫入狀態檔案 (sector 2)"""
-        self.write_sector(2, status.encode('utf-8'))
-
-    def simulate_llm_response(self, request: str) -> str:
-        """只呼叫新版 OpenAI API，失敗就顯示錯誤，不再有模擬回應"""
-        if not openai or not self.openai_api_key:
-            return "[錯誤] OpenAI API 未正確設定，請確認已安裝 openai 套件並設置 OPENAI_API_KEY。"
-        try:
-            client = openai.OpenAI(api_key=self.openai_api_key)
-            response = client.chat.completions.create(
-                model="gpt-3.5-turbo",
-                messages=[
-                    {"role": "system", "content": "你是 RISC-V OS 的 AI 助手，請用繁體中文回答。"},
-                    {"role": "user", "content": request}
-                ],
-                max_tokens=256,
-                temperature=0.7
-            )
-            reply = response.choices[0].message.content.strip()
-            return reply
-        except Exception as e:
-            return f"[OpenAI API 錯誤] {e}"
+        self.host = HostHeader()
+        self.backend = backend
+        self.workers = workers
+        self.timeout = timeout  # 每個請求最多花多少秒，None 表示不限
+        self.pool = ThreadPoolExecutor(max_workers=workers, thread_name_prefix="llm")
+        # 保護 host header、磁碟寫入、socket 送出與終端輸出；worker 只在寫回時持有
+        self.lock = threading.Lock()
+        self.dispatched = 0    # 已交給 worker 的最大請求 ID
+        self.completed = set()  # 已完成但還接不上 consumer 的請求 ID
+        self.cancelled = set()  # virtio-console 模式下 guest 取消的請求 ID
 
-    def process_requests(self):
-        """處理請求的主迴圈"""
-        print("=== LLM Host 服務啟動 ===")
-        print(f"監控檔案：{self.disk_file}")
-        print("等待 OS 端請求...")
+    def log(self, *args):
+        with self.lock:
+            print(*args, flush=True)
 
-        while True:
-            try:
-                # 檢查狀態
-                current_status = self.get_status()
+    def backend_stream(self, request: str, out: queue.Queue, stop: threading.Event):
+        """在自己的執行緒跑後端，每段放進 out，結束時放 None；後端丟出例外時
+        改放錯誤訊息。stop 設定後收到下一段就結束（卡住的後端只能等它自己返回）"""
+        try:
+            for chunk in self.backend.stream(request):
+                if stop.is_set():
+                    return
+                out.put(chunk)
+        except Exception as e:
+            out.put(ErrorText(f"\n[錯誤] 後端失敗：{e}"))
+        finally:
+            out.put(None)
 
-                # 如果有新請求
-                if current_status == "request_sent":
-                    print("\n[收到新請求]")
+    def respond(self, request: str) -> Iterator[str]:
+        """後端的回應，超過 self.timeout 秒就截斷並附上說明。後端在另一個執行緒
+        產生，卡在兩段之間（包括第一段之前）也會準時逾時，不會佔住 worker"""
+        deadline = None if self.timeout is None else time.monotonic() + self.timeout
+        out = queue.Queue()
+        stop = threading.Event()
+        threading.Thread(target=self.backend_stream, args=(request, out, stop),
+                         daemon=True).start()
+        try:
+            while True:
+                try:
+                    if deadline is None:
+                        chunk = out.get()
+                    else:
+                        chunk = out.get(timeout=max(deadline - time.monotonic(), 0))
+                except queue.Empty:
+                    yield ErrorText(f"\n[逾時] 回應超過 {self.timeout:g} 秒，已截斷。")
+                    return
+                if chunk is None:
+                    return
+                yield chunk
+        finally:
+            stop.set()  # 逾時、取消或出錯後不再要後端剩下的內容
 
-                    # 讀取請求內容
-                    request = self.get_request()
-                    print(f"請求內容：{request}")
+    def sync_epoch(self, epoch: int):
+        """guest 重新開機後 epoch 會改變，丟掉上一輪的 consumer 與回應；
+        上一輪還在跑的 worker 寫回前會發現 epoch 不同而放棄"""
+        with self.lock:
+            if self.host.epoch == epoch:
+                return
+            print(f"\n[guest epoch {epoch}，重設請求環]")
+            self.host = HostHeader(epoch=epoch)
+            self.dispatched = 0
+            self.completed.clear()
+            self.disk.write_host_header(self.host)
 
-                    # 模擬 LLM 處理（這裡可以替換為真實的 LLM API）
-                    print("正在處理請求...")
-                    response = self.simulate_llm_response(request)
-                    print(f"回應內容：{response}")
+    def handle_request(self, request_id: int, epoch: int):
+        """在 worker 執行緒中處理一個請求：每收到一段就先寫回應內容，再更新
+        host header 的 resp_len，最後補上訊框 header（含 CRC）才標記完成。
+        各請求只寫自己的槽位，所以可以互相交錯。"""
+        slot = slot_of(request_id)
+        area = resp_sector(slot)
+        started = time.monotonic()
+        try:
+            request = self.disk.read_text(req_sector(slot), request_id, MAX_REQUEST_SIZE)
+            chunks = self.respond(request)
+        except ValueError as e:
+            request = f"[損毀的請求] {e}"
+            chunks = iter([ErrorText(f"[錯誤] 請求訊框損毀：{e}")])
+        self.log(f"[請求 #{request_id}，槽位 {slot}] {request}")
 
-                    # 寫入回應
-                    self.set_response(response)
+        data = b""
+        limit = MAX_RESPONSE_SIZE - 1  # 截斷過一次就降到目前長度，後面的段落不再接上
+        nocache = False  # 出現錯誤訊息時 guest 不可快取這則回應
+        with self.lock:
+            if self.host.epoch != epoch:
+                return
+            self.host.resp_id[slot] = request_id
+            self.host.resp_len[slot] = 0
+            self.host.nocache &= ~(1 << slot)
+        try:
+            for chunk in chunks:
+                nocache |= isinstance(chunk, ErrorText)
+                if self.disk.read_guest_header().cancel_id[slot] == request_id:
+                    self.log(f"[請求 #{request_id} 已被 guest 取消]")
+                    nocache = True
+                    break  # 仍然補上訊框並標記完成，guest 才能重用槽位
+                room = limit - len(data)
+                if room <= 0:
+                    continue  # 回應區已滿，剩下的丟掉
+                start = len(data)
+                piece = utf8_prefix(chunk, room)
+                if len(piece) < len(chunk.encode('utf-8')):
+                    limit = start + len(piece)  # 不然下一段可能塞進空隙，中間少了字
+                data += piece
+                with self.lock:
+                    if self.host.epoch != epoch:
+                        return  # guest 已重開機，這個槽位不再屬於此請求
+                    self.disk.write_msg_partial(area, request_id, data, start)
+                    self.host.resp_len[slot] = len(data)
+                    self.disk.write_host_header(self.host)
+        except Exception as e:
+            # 出錯也要補上訊框並標記完成：否則 guest 逾時取消後槽位成了孤兒，
+            # 永遠不會被回收，consumer 也停在這裡
+            self.log(f"[錯誤] 請求 #{request_id}：{e}")
+            nocache = True
+            data += utf8_prefix(f"\n[錯誤] {e}", MAX_RESPONSE_SIZE - 1 - len(data))
 
-                    # 更新狀態為回應就緒
-                    self.set_status("response_ready")
-                    print("[回應已寫入，等待 OS 讀取]")
+        with self.lock:
+            if self.host.epoch != epoch:
+                return
+            self.disk.finish_msg(area, request_id, data)
+            self.host.resp_len[slot] = len(data)
+            self.host.resp_done[slot] = request_id
+            if nocache:
+                self.host.nocache |= 1 << slot
+            # consumer 只推進到連續完成的最後一個 ID
+            self.completed.add(request_id)
+            while self.host.consumer + 1 in self.completed:
+                self.completed.remove(self.host.consumer + 1)
+                self.host.consumer += 1
+            self.disk.write_host_header(self.host)
+            text = data.decode('utf-8', errors='ignore')
+            print(f"[回應 #{request_id}，{len(data)} bytes，"
+                  f"{time.monotonic() - started:.2f} 秒] {text}", flush=True)
 
-                # 如果狀態是 idle，表示 OS 已經讀取了回應
-                elif current_status == "idle" and self.last_status == "response_ready":
-                    print("[OS 已讀取回應，等待下一個請求]")
+    def run_request(self, request_id: int, epoch: int):
+        """回應本身的錯誤 handle_request 已經處理，這裡只剩寫不了磁碟之類的失敗"""
+        try:
+            self.handle_request(request_id, epoch)
+        except Exception as e:
+            self.log(f"[錯誤] 請求 #{request_id}：{e}")
 
-                self.last_status = current_status
+    def process_requests(self):
+        """處理請求的主迴圈：只負責依 producer 順序把新請求分派給 worker"""
+        print("=== LLM Host 服務啟動 ===")
+        print(f"監控檔案：{self.disk_file}（請求環 {RING_SLOTS} 個槽位，mmap）")
+        print(f"後端：{self.backend.name}，{self.workers} 個 worker")
+        print("等待 OS 端請求...")
 
-                # 短暫休眠避免過度佔用 CPU
-                time.sleep(0.1)
+        self.disk = RingDisk(self.disk_file)
+        seen = None  # 上一次分派完時的 guest_seq()
+        while True:
+            try:
+                self.disk.wait_guest_change(seen)
+                seq = self.disk.guest_seq()
+                guest = self.disk.read_guest_header()
+                if guest.valid:
+                    self.sync_epoch(guest.epoch)
+                    while self.dispatched < guest.producer:
+                        request_id = self.dispatched + 1
+                        if guest.req_id[slot_of(request_id)] != request_id:
+                            break  # header 寫到一半，下一輪再讀
+                        self.dispatched = request_id
+                        self.pool.submit(self.run_request, request_id, guest.epoch)
+                # 請求還沒分派完（header 寫到一半）就不記下，下一輪立刻重試
+                if not guest.valid or self.dispatched >= guest.producer:
+                    seen = seq
 
             except KeyboardInterrupt:
                 print("\n[服務停止]")
@@ -129,10 +196,112 @@ class LLMHostService:
             except Exception as e:
                 print(f"[錯誤] {e}")
                 time.sleep(1)
+        self.pool.shutdown(wait=False, cancel_futures=True)
+
+    def stream_to_socket(self, conn: FrameSocket, request_id: int, request: str):
+        """在 worker 執行緒中回應一個 virtio-console 請求；訊框整個送出後才放開鎖，
+        不同請求的 CHUNK 可以交錯，guest 依 id 分開收集"""
+        started = time.monotonic()
+        sent = 0
+        limit = MAX_RESPONSE_SIZE - 1  # 同 handle_request，截斷後不再送後面的段落
+        nocache = False
+        try:
+            try:
+                for chunk in self.respond(request):
+                    nocache |= isinstance(chunk, ErrorText)
+                    if request_id in self.cancelled:
+                        self.cancelled.discard(request_id)
+                        self.log(f"[請求 #{request_id:#x} 已被 guest 取消]")
+                        return  # guest 已經放掉槽位，不必再送 END
+                    data = utf8_prefix(chunk, limit - sent)
+                    if len(data) < len(chunk.encode('utf-8')):
+                        limit = sent + len(data)
+                    if data:
+                        with self.lock:
+                            conn.send_frame(FRAME_CHUNK, request_id, data)
+                        sent += len(data)
+            except OSError:
+                raise  # socket 壞了，END 也送不出去
+            except Exception as e:
+                # 照樣送 END，guest 才會結束這個請求而不是等到逾時
+                self.log(f"[錯誤] 請求 #{request_id:#x}：{e}")
+                nocache = True
+                data = utf8_prefix(f"\n[錯誤] {e}", MAX_RESPONSE_SIZE - 1 - sent)
+                if data:
+                    with self.lock:
+                        conn.send_frame(FRAME_CHUNK, request_id, data)
+                    sent += len(data)
+            with self.lock:
+                conn.send_frame(FRAME_END_NOCACHE if nocache else FRAME_END, request_id)
+            self.cancelled.discard(request_id)  # 回應送完才收到的取消
+            self.log(f"[回應 #{request_id:#x}，{sent} bytes，{time.monotonic() - started:.2f} 秒]")
+        except OSError as e:
+            self.log(f"[錯誤] 請求 #{request_id:#x}：{e}")
+
+    def serve_socket(self, path: str):
+        """virtio-console 模式：阻塞讀取訊框，每個 REQUEST 交給一個 worker"""
+        print("=== LLM Host 服務啟動（virtio-console）===")
+        print(f"連接 socket：{path}")
+        print(f"後端：{self.backend.name}，{self.workers} 個 worker")
+        conn = FrameSocket(path)
+        epoch = None  # guest 開機時會重送 HELLO 直到收到回音，同一個 epoch 只記一次
+
+        while True:
+            try:
+                ftype, fid, payload = conn.recv_frame()
+                if ftype == FRAME_HELLO:
+                    # 送回去 guest 才知道有人接；沒收到的話它會改走磁碟請求環
+                    with self.lock:
+                        conn.send_frame(FRAME_HELLO, fid)
+                    if fid != epoch:
+                        epoch = fid
+                        self.log(f"\n[guest 開機，epoch {fid}]")
+                elif ftype == FRAME_REQUEST:
+                    request = payload.decode('utf-8', errors='ignore')
+                    self.log(f"[請求 #{fid:#x}] {request}")
+                    self.pool.submit(self.stream_to_socket, conn, fid, request)
+                elif ftype == FRAME_CANCEL:
+                    self.cancelled.add(fid)
+                else:
+                    self.log(f"[錯誤] 未知的訊框類型 {ftype}")
+
+            except KeyboardInterrupt:
+                print("\n[服務停止]")
+                break
+            except ConnectionError as e:
+                print(f"[連線中斷] {e}")
+                break
+        self.pool.shutdown(wait=False, cancel_futures=True)
 
 def main():
-    service = LLMHostService()
-    service.process_requests()
+    parser = argparse.ArgumentParser(description="RISC-V OS 的 host 端 LLM 服務")
+    parser.add_argument("--disk", default="lorem.txt", help="與 QEMU 共用的磁碟映像檔")
+    parser.add_argument("--socket",
+                        help="virtio-console 的 UNIX socket（run.sh 的 LLM_SOCKET）")
+    parser.add_argument("--workers", type=int, default=4,
+                        help="同時處理的請求數（磁碟模式最多用到 %d 個）" % RING_SLOTS)
+    parser.add_argument("--timeout", type=float, default=120.0,
+                        help="每個請求最多花多少秒，超過就截斷回應（0 表示不限）")
+    parser.add_argument("--stub", action="store_true",
+                        help="使用離線、可重現的假後端（不需要 OpenAI API）")
+    parser.add_argument("--stub-bytes", type=int, default=0,
+                        help="stub 回覆至少這麼多位元組（測試長回應）")
+    parser.add_argument("--stub-latency", type=float, default=0.0,
+                        help="stub 送出第一段前等待的秒數")
+    parser.add_argument("--stub-interval", type=float, default=0.2,
+                        help="stub 每段之間的秒數")
+    args = parser.parse_args()
+
+    timeout = args.timeout or None
+    if args.stub:
+        backend = StubBackend(args.stub_latency, args.stub_interval, args.stub_bytes)
+    else:
+        backend = OpenAIBackend(timeout=timeout or 600.0)
+    service = LLMHostService(backend, args.disk, max(1, args.workers), timeout)
+    if args.socket:
+        service.serve_socket(args.socket)
+    else:
+        service.process_requests()
 
 if __name__ == "__main__":
     main()
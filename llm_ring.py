@@ -0,0 +1,273 @@
+"""
+guest <-> host LLM 請求環的磁碟格式（與 llm.h 對應）
+
+Sector 0: guest header（guest 寫、host 讀）
+Sector 1: host header（host 寫、guest 讀）
+Sector 2 起: 每個槽位一個請求區（REQ_SECTORS）與一個回應區（RESP_SECTORS）
+
+請求與回應都是訊框：MSG_HDR（magic, id, len, crc32）後面緊接內容，佔用連續磁區。
+回應可以串流：先寫內容，再增加 resp_len，最後寫好訊框 header 才設 resp_done。
+
+接了 virtio-console 時改用 socket 上的訊框（FRAME_FORMAT），不經過磁碟。
+"""
+
+import mmap
+import os
+import socket
+import struct
+import time
+import zlib
+from dataclasses import dataclass, field
+from typing import List, Tuple
+
+SECTOR_SIZE = 512
+MAX_REQUEST_SIZE = 4080    # 含結尾的 NUL，與 common.h 相同
+MAX_RESPONSE_SIZE = 32752
+RING_SLOTS = 8
+GUEST_HDR_SECTOR = 0
+HOST_HDR_SECTOR = 1
+SLOT_BASE_SECTOR = 2
+GUEST_MAGIC = 0x474D4C4C  # "LLMG"
+HOST_MAGIC = 0x484D4C4C   # "LLMH"
+
+# 4 個 uint32 欄位 + 每槽位的 uint32 陣列（guest、host 各三個），little endian
+GUEST_HDR_FORMAT = f"<4I{RING_SLOTS}I{RING_SLOTS}I{RING_SLOTS}I"
+HOST_HDR_FORMAT = f"<4I{RING_SLOTS}I{RING_SLOTS}I{RING_SLOTS}I"
+
+
+MSG_HDR_FORMAT = "<4I"
+MSG_HDR_SIZE = struct.calcsize(MSG_HDR_FORMAT)
+MSG_MAGIC = 0x4D4D4C4C  # "LLMM"
+
+
+def msg_sectors(size: int) -> int:
+    return (MSG_HDR_SIZE + size + SECTOR_SIZE - 1) // SECTOR_SIZE
+
+
+REQ_SECTORS = msg_sectors(MAX_REQUEST_SIZE)
+RESP_SECTORS = msg_sectors(MAX_RESPONSE_SIZE)
+SLOT_SECTORS = REQ_SECTORS + RESP_SECTORS
+DISK_SECTORS = SLOT_BASE_SECTOR + RING_SLOTS * SLOT_SECTORS
+
+# virtio-console 訊框：magic, type, id, len，後面接 len 個位元組
+FRAME_FORMAT = "<4I"
+FRAME_HDR_SIZE = struct.calcsize(FRAME_FORMAT)
+FRAME_MAGIC = 0x464D4C4C  # "LLMF"
+FRAME_HELLO = 1    # guest -> host，id 為 epoch；host 原樣送回，guest 收到才改走 console
+FRAME_REQUEST = 2  # guest -> host
+FRAME_CHUNK = 3    # host -> guest
+FRAME_END = 4      # host -> guest
+FRAME_END_NOCACHE = 5  # host -> guest，回應結束但不可快取
+FRAME_CANCEL = 6   # guest -> host，取消請求 id
+
+
+def req_sector(slot: int) -> int:
+    return SLOT_BASE_SECTOR + slot * SLOT_SECTORS
+
+
+def resp_sector(slot: int) -> int:
+    return req_sector(slot) + REQ_SECTORS
+
+
+def slot_of(request_id: int) -> int:
+    """請求 ID 從 1 開始連號，依序放進槽位"""
+    return (request_id - 1) % RING_SLOTS
+
+
+def utf8_prefix(text: str, limit: int) -> bytes:
+    """text 的 UTF-8 編碼最多 limit 個位元組，截斷時退回最後一個完整的字元，
+    guest 印出來（或放進快取）的才不會是半個字"""
+    data = text.encode('utf-8')
+    if len(data) <= limit:
+        return data
+    end = max(limit, 0)
+    while end > 0 and data[end] & 0xC0 == 0x80:  # 截斷點落在多位元組字元的中間
+        end -= 1
+    return data[:end]
+
+
+@dataclass
+class GuestHeader:
+    magic: int = 0
+    epoch: int = 0
+    nslots: int = 0
+    producer: int = 0
+    req_id: List[int] = field(default_factory=lambda: [0] * RING_SLOTS)
+    req_len: List[int] = field(default_factory=lambda: [0] * RING_SLOTS)
+    cancel_id: List[int] = field(default_factory=lambda: [0] * RING_SLOTS)  # guest 已取消的請求
+
+    @property
+    def valid(self) -> bool:
+        return self.magic == GUEST_MAGIC and self.nslots == RING_SLOTS
+
+    @classmethod
+    def unpack(cls, data: bytes) -> "GuestHeader":
+        v = struct.unpack_from(GUEST_HDR_FORMAT, data)
+        n = RING_SLOTS
+        return cls(v[0], v[1], v[2], v[3], list(v[4:4 + n]),
+                   list(v[4 + n:4 + 2 * n]), list(v[4 + 2 * n:]))
+
+    def pack(self) -> bytes:
+        return struct.pack(GUEST_HDR_FORMAT, self.magic, self.epoch, self.nslots,
+                           self.producer, *self.req_id, *self.req_len, *self.cancel_id)
+
+
+@dataclass
+class HostHeader:
+    magic: int = HOST_MAGIC
+    epoch: int = 0
+    consumer: int = 0
+    nocache: int = 0  # 位元 slot：該槽位的回應不可快取（錯誤或逾時）
+    resp_id: List[int] = field(default_factory=lambda: [0] * RING_SLOTS)
+    resp_len: List[int] = field(default_factory=lambda: [0] * RING_SLOTS)
+    resp_done: List[int] = field(default_factory=lambda: [0] * RING_SLOTS)
+
+    @classmethod
+    def unpack(cls, data: bytes) -> "HostHeader":
+        v = struct.unpack_from(HOST_HDR_FORMAT, data)
+        n = RING_SLOTS
+        return cls(v[0], v[1], v[2], v[3], list(v[4:4 + n]),
+                   list(v[4 + n:4 + 2 * n]), list(v[4 + 2 * n:]))
+
+    def pack(self) -> bytes:
+        return struct.pack(HOST_HDR_FORMAT, self.magic, self.epoch, self.consumer,
+                           self.nocache, *self.resp_id, *self.resp_len,
+                           *self.resp_done)
+
+
+# 等待 guest 時的輪詢間隔：有動靜後從最短開始，閒置時逐步加倍到最長
+POLL_MIN = 0.001
+POLL_MAX = 0.02
+
+
+class RingDisk:
+    """以磁區為單位讀寫磁碟映像檔。
+
+    整個映像檔在服務期間保持 MAP_SHARED 映射：QEMU 透過 page cache 寫入的
+    內容直接可見，讀取不需要任何系統呼叫；寫入後以 msync 寫回。
+    """
+
+    def __init__(self, disk_file: str = "lorem.txt"):
+        self.disk_file = disk_file
+        with open(disk_file, 'r+b') as f:
+            size = os.fstat(f.fileno()).st_size
+            if size < DISK_SECTORS * SECTOR_SIZE:
+                raise ValueError(f"{disk_file} 只有 {size} bytes，放不下請求環"
+                                 f"（至少 {DISK_SECTORS * SECTOR_SIZE}）")
+            self.mm = mmap.mmap(f.fileno(), size)
+
+    def close(self):
+        self.mm.close()
+
+    def read_sectors(self, sector_num: int, count: int = 1) -> bytes:
+        start = sector_num * SECTOR_SIZE
+        return self.mm[start:start + count * SECTOR_SIZE]
+
+    def read_sector(self, sector_num: int) -> bytes:
+        return self.read_sectors(sector_num)
+
+    def write_sector(self, sector_num: int, data: bytes):
+        """寫入從 sector_num 開始的連續磁區，最後一個磁區補零，並 msync 涵蓋的頁面"""
+        count = max(1, (len(data) + SECTOR_SIZE - 1) // SECTOR_SIZE)
+        start = sector_num * SECTOR_SIZE
+        end = start + count * SECTOR_SIZE
+        self.mm[start:end] = data.ljust(count * SECTOR_SIZE, b'\x00')
+        page = start - start % mmap.PAGESIZE  # msync 的起點必須對齊頁面
+        self.mm.flush(page, end - page)
+
+    def guest_seq(self) -> Tuple[int, int]:
+        """guest header 的 (epoch, producer)：guest 每送出一個請求或重開機都會改變"""
+        _, epoch, _, producer = struct.unpack_from(
+            "<4I", self.mm, GUEST_HDR_SECTOR * SECTOR_SIZE)
+        return epoch, producer
+
+    def wait_guest_change(self, seen: Tuple[int, int], timeout: float = None) -> bool:
+        """等到 guest_seq() 不等於 seen；逾時回傳 False。閒置時每 POLL_MAX 秒
+        看一次映射裡的兩個欄位，幾乎不耗 CPU，反應時間也遠低於舊的 100ms。"""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        interval = POLL_MIN
+        while self.guest_seq() == seen:
+            if deadline is not None and time.monotonic() >= deadline:
+                return False
+            time.sleep(interval)
+            interval = min(interval * 2, POLL_MAX)
+        return True
+
+    def read_guest_header(self) -> GuestHeader:
+        return GuestHeader.unpack(self.read_sector(GUEST_HDR_SECTOR))
+
+    def read_host_header(self) -> HostHeader:
+        return HostHeader.unpack(self.read_sector(HOST_HDR_SECTOR))
+
+    def write_host_header(self, hdr: HostHeader):
+        self.write_sector(HOST_HDR_SECTOR, hdr.pack())
+
+    def read_msg(self, area: int, msg_id: int, max_size: int) -> bytes:
+        """讀取並檢查 area 開始的訊框，回傳內容；header 或 CRC 不符時丟出 ValueError"""
+        first = self.read_sector(area)
+        magic, fid, length, crc = struct.unpack_from(MSG_HDR_FORMAT, first)
+        if magic != MSG_MAGIC or fid != msg_id or length >= max_size:
+            raise ValueError(f"訊框 header 無效（magic={magic:#x} id={fid} len={length}）")
+        data = self.read_sectors(area, msg_sectors(length))[MSG_HDR_SIZE:MSG_HDR_SIZE + length]
+        if zlib.crc32(data) != crc:
+            raise ValueError(f"訊框 CRC 不符（{zlib.crc32(data):#x} != {crc:#x}）")
+        return data
+
+    @staticmethod
+    def _frame(msg_id: int, data: bytes, final: bool = True) -> bytes:
+        if not final:  # 串流中：header 先留空，guest 只看 host header 的 resp_len
+            return bytes(MSG_HDR_SIZE) + data
+        return struct.pack(MSG_HDR_FORMAT, MSG_MAGIC, msg_id, len(data),
+                           zlib.crc32(data)) + data
+
+    def write_msg(self, area: int, msg_id: int, data: bytes):
+        """一次寫入完整的訊框"""
+        self.write_sector(area, self._frame(msg_id, data))
+
+    def write_msg_partial(self, area: int, msg_id: int, data: bytes, start: int):
+        """串流：只重寫內容從 start 起所在的磁區（data 是到目前為止的全部內容）"""
+        first = (MSG_HDR_SIZE + start) // SECTOR_SIZE
+        frame = self._frame(msg_id, data, final=False)
+        self.write_sector(area + first, frame[first * SECTOR_SIZE:])
+
+    def finish_msg(self, area: int, msg_id: int, data: bytes):
+        """串流結束：補上訊框 header（只需重寫第一個磁區）"""
+        self.write_sector(area, self._frame(msg_id, data)[:SECTOR_SIZE])
+
+    def read_text(self, area: int, msg_id: int, max_size: int) -> str:
+        return self.read_msg(area, msg_id, max_size).decode('utf-8', errors='ignore')
+
+    def write_text(self, area: int, msg_id: int, text: str, max_size: int) -> int:
+        """寫入完整的訊框並回傳內容的位元組數（最多 max_size - 1，保留結尾）"""
+        data = utf8_prefix(text, max_size - 1)
+        self.write_msg(area, msg_id, data)
+        return len(data)
+
+
+class FrameSocket:
+    """透過 QEMU virtconsole 的 UNIX socket 收發訊框（阻塞式，不輪詢）"""
+
+    def __init__(self, path: str):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+
+    def _recv_exact(self, n: int) -> bytes:
+        data = b""
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise ConnectionError("QEMU 已關閉 socket")
+            data += chunk
+        return data
+
+    def recv_frame(self):
+        """回傳 (type, id, payload)；magic 不對時逐位元組往後找"""
+        hdr = self._recv_exact(FRAME_HDR_SIZE)
+        while struct.unpack_from("<I", hdr)[0] != FRAME_MAGIC:
+            hdr = hdr[1:] + self._recv_exact(1)
+        _, ftype, fid, length = struct.unpack(FRAME_FORMAT, hdr)
+        return ftype, fid, self._recv_exact(length)
+
+    def send_frame(self, ftype: int, fid: int, payload: bytes = b""):
+        self.sock.sendall(struct.pack(FRAME_FORMAT, FRAME_MAGIC, ftype, fid,
+                                      len(payload)) + payload)
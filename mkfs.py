@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""
+建立 kernel 的 extent 檔案系統（格式見 fs.h）
+
+檔案系統放在磁碟映像的 FS_BASE_SECTOR（320KB，前面是 LLM 請求環）。
+區塊 0 為 superblock，之後依序是 free-block bitmap、inode 表與資料區塊；
+放進去的每個檔案都是一段連續的區塊（一個 extent）。
+映像上已經有檔案系統時不會覆寫，除非加上 --force。
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+SECTOR_SIZE = 512
+FS_BASE_SECTOR = 640       # 與 kernel.h 相同
+BLOCK_SIZE = 4096          # FS_BLOCK_SIZE
+FS_MAGIC = 0x5346584C      # "LXFS"
+NAME_MAX = 56              # FS_NAME_MAX，含結尾的 NUL
+EXTENTS = 8                # FS_EXTENTS
+INODE_USED = 1
+FILES_MAX = 128            # kernel 支援的最多 inode 數
+
+SUPER_FORMAT = "<9I"
+INODE_FORMAT = f"<IHH{NAME_MAX}s{EXTENTS * 2}I"
+INODE_SIZE = struct.calcsize(INODE_FORMAT)
+assert INODE_SIZE == 128
+
+
+def parse_size(text: str) -> int:
+    units = {"K": 1024, "M": 1024 ** 2, "G": 1024 ** 3}
+    if text[-1:].upper() in units:
+        return int(text[:-1]) * units[text[-1].upper()]
+    return int(text)
+
+
+def has_fs(image: str) -> bool:
+    if not os.path.exists(image):
+        return False
+    with open(image, "rb") as f:
+        f.seek(FS_BASE_SECTOR * SECTOR_SIZE)
+        data = f.read(4)
+    return len(data) == 4 and struct.unpack("<I", data)[0] == FS_MAGIC
+
+
+def build(size: int, ninodes: int, paths: list) -> bytes:
+    nblocks = size // BLOCK_SIZE
+    bitmap_blocks = -(-nblocks // (BLOCK_SIZE * 8))
+    inode_blocks = -(-ninodes * INODE_SIZE // BLOCK_SIZE)
+    bitmap_start = 1
+    inode_start = bitmap_start + bitmap_blocks
+    data_start = inode_start + inode_blocks
+    if data_start >= nblocks:
+        raise ValueError(f"檔案系統太小：{size} 位元組")
+
+    fs = bytearray(nblocks * BLOCK_SIZE)
+    struct.pack_into(SUPER_FORMAT, fs, 0, FS_MAGIC, BLOCK_SIZE, nblocks, ninodes,
+                     bitmap_start, bitmap_blocks, inode_start, inode_blocks, data_start)
+
+    if len(paths) > ninodes:
+        raise ValueError(f"檔案太多：最多 {ninodes} 個")
+    next_block = data_start
+    for i, path in enumerate(paths):
+        name = os.path.basename(path).encode("utf-8")
+        if not name or len(name) >= NAME_MAX:
+            raise ValueError(f"檔名長度須為 1 到 {NAME_MAX - 1} 個位元組：{path}")
+        with open(path, "rb") as f:
+            data = f.read()
+        blocks = -(-len(data) // BLOCK_SIZE)
+        if next_block + blocks > nblocks:
+            raise ValueError(f"空間不足，放不下 {path}")
+
+        extents = [next_block, blocks] if blocks else [0, 0]
+        extents += [0] * (EXTENTS * 2 - 2)
+        struct.pack_into(INODE_FORMAT, fs, inode_start * BLOCK_SIZE + i * INODE_SIZE,
+                         len(data), INODE_USED, 1 if blocks else 0, name, *extents)
+        fs[next_block * BLOCK_SIZE:next_block * BLOCK_SIZE + len(data)] = data
+        next_block += blocks
+        print(f"  {name.decode('utf-8')}: {len(data)} 位元組")
+
+    # metadata 與已放入的檔案佔用的區塊，加上 bitmap 中超出檔案系統的位元
+    bitmap = bitmap_start * BLOCK_SIZE
+    for block in list(range(next_block)) + list(range(nblocks, bitmap_blocks * BLOCK_SIZE * 8)):
+        fs[bitmap + block // 8] |= 1 << (block % 8)
+
+    print(f"{nblocks} 個區塊（{BLOCK_SIZE} 位元組），{ninodes} 個 inode，"
+          f"可用 {nblocks - next_block} 個區塊")
+    return bytes(fs)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="在磁碟映像上建立 extent 檔案系統")
+    parser.add_argument("image", help="磁碟映像（例如 lorem.txt），不存在時建立")
+    parser.add_argument("files", nargs="*", help="要放進檔案系統的檔案")
+    parser.add_argument("--size", default="4M", help="檔案系統的大小（預設 4M）")
+    parser.add_argument("--inodes", type=int, default=FILES_MAX,
+                        help=f"inode 數（最多 {FILES_MAX}）")
+    parser.add_argument("--force", action="store_true", help="已經有檔案系統時也重建")
+    args = parser.parse_intermixed_args()
+
+    if has_fs(args.image) and not args.force:
+        print(f"{args.image} 已經有檔案系統，不重建（要重建請加 --force）")
+        return
+    if not 0 < args.inodes <= FILES_MAX:
+        sys.exit(f"inode 數須為 1 到 {FILES_MAX}")
+
+    try:
+        fs = build(parse_size(args.size), args.inodes, args.files)
+    except ValueError as e:
+        sys.exit(f"mkfs: {e}")
+
+    offset = FS_BASE_SECTOR * SECTOR_SIZE
+    with open(args.image, "r+b" if os.path.exists(args.image) else "w+b") as f:
+        f.seek(offset)
+        f.write(fs)
+    print(f"已在 {args.image} 的位移 {offset} 建立檔案系統")
+
+
+if __name__ == "__main__":
+    main()
@@ -3,28 +3,184 @@
 
 extern char __free_ram[], __free_ram_end[];
 
-static paddr_t next_paddr = 0;
+// Buddy 配置器：以 2^order 頁為單位管理 __free_ram..__free_ram_end。
+// 空閒區塊的串列節點直接存放在區塊本身（核心為恆等映射），
+// 每頁一個位元組的 page_info 記錄區塊大小與是否空閒。
+#define PAGE_INFO_FREE 0x80 // 空閒區塊的第一頁
+#define PAGE_INFO_USED 0x40 // 已配置區塊的第一頁
 
-// 記憶體分配
+struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+};
+
+static struct free_block *free_lists[BUDDY_MAX_ORDER + 1];
+static uint32_t free_counts[BUDDY_MAX_ORDER + 1];
+static uint8_t *page_info;   // 只有區塊的第一頁有意義
+static paddr_t buddy_base;   // 第一個可配置頁面
+static uint32_t buddy_pages; // 可配置的頁數
+static uint32_t free_page_count;
+static struct spinlock mm_lock; // 保護上面所有配置器狀態
+
+static uint32_t page_index(paddr_t paddr) {
+    return (paddr - buddy_base) / PAGE_SIZE;
+}
+
+static struct free_block *page_block(uint32_t index) {
+    return (struct free_block *) (buddy_base + index * PAGE_SIZE);
+}
+
+static void free_list_push(uint32_t index, int order) {
+    struct free_block *b = page_block(index);
+    b->prev = NULL;
+    b->next = free_lists[order];
+    if (b->next)
+        b->next->prev = b;
+    free_lists[order] = b;
+    free_counts[order]++;
+    page_info[index] = PAGE_INFO_FREE | order;
+}
+
+static void free_list_remove(uint32_t index, int order) {
+    struct free_block *b = page_block(index);
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        free_lists[order] = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    free_counts[order]--;
+    page_info[index] = 0;
+}
+
+static int pages_to_order(uint32_t n) {
+    int order = 0;
+    while ((1u << order) < n)
+        order++;
+    return order;
+}
+
+static void buddy_init(void) {
+    paddr_t start = (paddr_t) __free_ram;
+    uint32_t total = ((paddr_t) __free_ram_end - start) / PAGE_SIZE;
+
+    // page_info 本身放在空閒記憶體的開頭
+    uint32_t info_pages = align_up(total, PAGE_SIZE) / PAGE_SIZE;
+    page_info = (uint8_t *) start;
+    memset(page_info, 0, info_pages * PAGE_SIZE);
+    buddy_base = start + info_pages * PAGE_SIZE;
+    buddy_pages = total - info_pages;
+
+    // 由低到高放入能對齊的最大區塊
+    uint32_t index = 0;
+    while (index < buddy_pages) {
+        int order = BUDDY_MAX_ORDER;
+        while ((index & ((1u << order) - 1)) != 0 || index + (1u << order) > buddy_pages)
+            order--;
+        free_list_push(index, order);
+        index += 1u << order;
+    }
+    free_page_count = buddy_pages;
+}
+
+// 配置 n 個連續頁面（實際配置 2^order 頁）並清為 0；記憶體不足時回傳 0
+paddr_t try_alloc_pages(uint32_t n) {
+    int order = pages_to_order(n);
+    if (order > BUDDY_MAX_ORDER)
+        return 0;
+
+    spin_lock(&mm_lock);
+    if (!page_info)
+        buddy_init();
+
+    int o = order;
+    while (o <= BUDDY_MAX_ORDER && !free_lists[o])
+        o++;
+    if (o > BUDDY_MAX_ORDER) {
+        spin_unlock(&mm_lock);
+        return 0;
+    }
+
+    uint32_t index = page_index((paddr_t) free_lists[o]);
+    free_list_remove(index, o);
+    // 切半，後半放回較小一階的串列
+    while (o > order) {
+        o--;
+        free_list_push(index + (1u << o), o);
+    }
+    page_info[index] = PAGE_INFO_USED | order;
+    free_page_count -= 1u << order;
+    spin_unlock(&mm_lock);
+
+    // 區塊已經是自己的，清零不必持有鎖
+    paddr_t paddr = buddy_base + index * PAGE_SIZE;
+    memset((void *)paddr, 0, (1u << order) * PAGE_SIZE);
+    return paddr;
+}
+
+// 同 try_alloc_pages，但配置失敗時 PANIC（核心本身需要的記憶體）
 paddr_t alloc_pages(uint32_t n) {
-    if (next_paddr == 0) {
-        next_paddr = (paddr_t)__free_ram;
-    }
-    paddr_t paddr = next_paddr;
-    next_paddr += n * PAGE_SIZE;
-    if (next_paddr > (paddr_t)__free_ram_end)
-        PANIC("out of memory");
-    memset((void *)paddr, 0, n * PAGE_SIZE);
+    paddr_t paddr = try_alloc_pages(n);
+    if (!paddr)
+        PANIC("alloc_pages: out of memory (%d pages)", n);
     return paddr;
 }
 
+// 釋放 alloc_pages(n) 取得的頁面，並與空閒的 buddy 合併
+void free_pages(paddr_t paddr, uint32_t n) {
+    int order = pages_to_order(n);
+    uint32_t index = page_index(paddr);
+    if (paddr < buddy_base || index >= buddy_pages || !is_aligned(paddr, PAGE_SIZE))
+        PANIC("free_pages: invalid paddr %p", paddr);
+
+    spin_lock(&mm_lock);
+    if (page_info[index] != (PAGE_INFO_USED | order))
+        PANIC("free_pages: bad free of %p (order %d)", paddr, order);
+
+    page_info[index] = 0;
+    free_page_count += 1u << order;
+    while (order < BUDDY_MAX_ORDER) {
+        uint32_t buddy = index ^ (1u << order);
+        if (buddy + (1u << order) > buddy_pages
+            || page_info[buddy] != (PAGE_INFO_FREE | order))
+            break;
+        free_list_remove(buddy, order);
+        index &= ~(1u << order);
+        order++;
+    }
+    free_list_push(index, order);
+    spin_unlock(&mm_lock);
+}
+
+void mm_get_stats(struct mm_stats *out) {
+    struct mm_stats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    spin_lock(&mm_lock);
+    if (!page_info)
+        buddy_init();
+    stats.total_pages = buddy_pages;
+    stats.free_pages = free_page_count;
+    for (int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        stats.free_blocks[order] = free_counts[order];
+        if (free_counts[order])
+            stats.largest_free_block = 1u << order;
+    }
+    spin_unlock(&mm_lock);
+
+    // 碎片化程度：空閒頁中無法以最大空閒區塊一次取得的比例
+    stats.fragmentation = stats.free_pages
+        ? 100 - stats.largest_free_block * 100 / stats.free_pages : 0;
+    *out = stats;
+}
+
 // 頁面映射
 void map_page(uint32_t *table1, uint32_t vaddr, paddr_t paddr, uint32_t flags) {
     if (!is_aligned(vaddr, PAGE_SIZE))
-        PANIC("unaligned vaddr %x", vaddr);
+        PANIC("unaligned vaddr %p", vaddr);
 
     if (!is_aligned(paddr, PAGE_SIZE))
-        PANIC("unaligned paddr %x", paddr);
+        PANIC("unaligned paddr %p", paddr);
 
     uint32_t vpn1 = (vaddr >> 22) & 0x3ff;
     if ((table1[vpn1] & PAGE_V) == 0) {
@@ -35,4 +191,118 @@ void map_page(uint32_t *table1, uint32_t vaddr, paddr_t paddr, uint32_t flags) {
     uint32_t vpn0 = (vaddr >> 12) & 0x3ff;
     uint32_t *table0 = (uint32_t *) ((table1[vpn1] >> 10) * PAGE_SIZE);
     table0[vpn0] = ((paddr / PAGE_SIZE) << 10) | flags | PAGE_V;
-}
\ No newline at end of file
+}
+
+// 以 4MB megapage 映射（第一層直接放葉節點，不需要第二層頁表）
+void map_megapage(uint32_t *table1, uint32_t vaddr, paddr_t paddr, uint32_t flags) {
+    if (!is_aligned(vaddr, MEGAPAGE_SIZE))
+        PANIC("unaligned megapage vaddr %p", vaddr);
+
+    if (!is_aligned(paddr, MEGAPAGE_SIZE))
+        PANIC("unaligned megapage paddr %p", paddr);
+
+    uint32_t vpn1 = (vaddr >> 22) & 0x3ff;
+    if (table1[vpn1] & PAGE_V)
+        PANIC("megapage %p already mapped", vaddr);
+    table1[vpn1] = ((paddr / PAGE_SIZE) << 10) | flags | PAGE_V;
+}
+
+// 釋放頁表中所有使用者頁面與第二層頁表；核心的 megapage 項目是共用的，保留不動
+void unmap_user_pages(uint32_t *table1) {
+    for (int vpn1 = 0; vpn1 < 1024; vpn1++) {
+        uint32_t pte1 = table1[vpn1];
+        if ((pte1 & PAGE_V) == 0 || (pte1 & (PAGE_R | PAGE_W | PAGE_X)))
+            continue;
+
+        uint32_t *table0 = (uint32_t *) ((pte1 >> 10) * PAGE_SIZE);
+        for (int vpn0 = 0; vpn0 < 1024; vpn0++) {
+            uint32_t pte0 = table0[vpn0];
+            if ((pte0 & PAGE_V) && (pte0 & PAGE_U))
+                free_pages((pte0 >> 10) * PAGE_SIZE, 1);
+        }
+        free_pages((paddr_t) table0, 1);
+        table1[vpn1] = 0;
+    }
+}
+
+// 查詢 vaddr 對應的實體位址，並檢查頁面權限包含 flags；無效時回傳 0
+paddr_t walk_page(uint32_t *table1, vaddr_t vaddr, uint32_t flags) {
+    uint32_t pte1 = table1[(vaddr >> 22) & 0x3ff];
+    if ((pte1 & PAGE_V) == 0)
+        return 0;
+
+    if (pte1 & (PAGE_R | PAGE_W | PAGE_X)) {
+        // megapage 葉節點
+        if ((pte1 & flags) != flags)
+            return 0;
+        return ((pte1 >> 10) * PAGE_SIZE) | (vaddr & (MEGAPAGE_SIZE - 1));
+    }
+
+    uint32_t *table0 = (uint32_t *) ((pte1 >> 10) * PAGE_SIZE);
+    uint32_t pte0 = table0[(vaddr >> 12) & 0x3ff];
+    if ((pte0 & PAGE_V) == 0 || (pte0 & flags) != flags)
+        return 0;
+    return ((pte0 >> 10) * PAGE_SIZE) | (vaddr & (PAGE_SIZE - 1));
+}
+
+// 把使用者緩衝區 [vaddr, vaddr + len) 轉成實體位址的 iovec，讓裝置直接 DMA，
+// 實體相鄰的頁面會合併成一段。回傳段數；位址無效或超過 max 段時回傳 -1。
+int user_buf_to_iov(uint32_t *table1, vaddr_t vaddr, size_t len, int writable,
+                    struct blk_iovec *iov, int max) {
+    uint32_t flags = PAGE_U | PAGE_R | (writable ? PAGE_W : 0);
+    int n = 0;
+    while (len > 0) {
+        paddr_t paddr = walk_page(table1, vaddr, flags);
+        if (!paddr)
+            return -1;
+
+        size_t chunk = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+        if (chunk > len)
+            chunk = len;
+
+        if (n > 0 && (paddr_t) iov[n - 1].base + iov[n - 1].len == paddr) {
+            iov[n - 1].len += chunk;
+        } else {
+            if (n == max)
+                return -1;
+            iov[n].base = (void *) paddr;
+            iov[n].len = chunk;
+            n++;
+        }
+        vaddr += chunk;
+        len -= chunk;
+    }
+    return n;
+}
+
+// 使用者位址 [vaddr, vaddr + len) 的每一頁都帶 flags（須含 PAGE_U）時回傳 true
+bool user_range_ok(uint32_t *table1, vaddr_t vaddr, size_t len, uint32_t flags) {
+    if (vaddr + len < vaddr)
+        return false;
+    for (vaddr_t page = vaddr & ~(PAGE_SIZE - 1); page < vaddr + len; page += PAGE_SIZE) {
+        if (!walk_page(table1, page, flags))
+            return false;
+    }
+    return true;
+}
+
+// 目前進程在 vaddr 的字串長度（不含 NUL），最多算到 max。字串在 NUL 或 max 之前
+// 碰到不是使用者可讀的頁面時回傳 -1
+int strnlen_user(vaddr_t vaddr, size_t max) {
+    for (size_t n = 0; n < max; n++) {
+        if ((n == 0 || ((vaddr + n) & (PAGE_SIZE - 1)) == 0)
+            && !walk_page(current_proc->page_table, vaddr + n, PAGE_U | PAGE_R))
+            return -1;
+        if (((const char *) vaddr)[n] == '\0')
+            return n;
+    }
+    return max;
+}
+
+// 把核心的資料複製到目前進程的 dst。整段都是使用者可寫的頁面才複製，否則回傳 -1
+int copy_to_user(vaddr_t dst, const void *src, size_t len) {
+    if (!user_range_ok(current_proc->page_table, dst, len, PAGE_U | PAGE_W))
+        return -1;
+    memcpy((void *) dst, src, len);
+    return 0;
+}
@@ -4,13 +4,27 @@ set -xue
 # QEMU 執行檔路徑，保持不變
 QEMU=qemu-system-riscv32
 
+# hart 數量（核心最多支援 CPUS_MAX 個），可用 SMP=1 ./run.sh 改回單核
+SMP=${SMP:-4}
+
+# 設定 LLM_SOCKET=llm.sock 時，LLM 訊息改走 virtio-console，host 端接在這個
+# UNIX socket 上（python3 llm_host_service.py --socket llm.sock）；沒設定就走磁碟。
+# host 要在開機後三秒內連上，否則 guest 改走磁碟上的請求環
+LLM_SOCKET=${LLM_SOCKET:-}
+LLM_ARGS=()
+if [ -n "$LLM_SOCKET" ]; then
+    LLM_ARGS=(-chardev socket,id=llm,path=$LLM_SOCKET,server=on,wait=off
+              -device virtio-serial-device,bus=virtio-mmio-bus.1
+              -device virtconsole,chardev=llm)
+fi
+
 # 使用 clang 作為交叉編譯器，並設定目標為 riscv32
 export CC=clang
 # 這裡我們加上 -march 與 -mabi 參數確保使用正確的 RISC-V 32 位架構與 ABI
 export CFLAGS="-std=c11 -O2 -g3 -Wall -Wextra --target=riscv32 -ffreestanding -nostdlib -march=rv32imac -mabi=ilp32"
 
 # 構建用戶應用程序 (shell.elf)
-$CC $CFLAGS -Wl,-Tuser.ld -Wl,-Map=shell.map -o shell.elf shell.c user.c common.c
+$CC $CFLAGS -Wl,-Tuser.ld -Wl,-Map=shell.map -o shell.elf shell.c bench.c user.c common.c
 
 # 使用 llvm-objcopy（或系統中的 objcopy）將 ELF 轉為純二進制文件
 if command -v llvm-objcopy > /dev/null 2>&1; then
@@ -26,10 +40,16 @@ $OBJCOPY --set-section-flags .bss=alloc,contents -O binary shell.elf shell.bin
 $OBJCOPY -I binary -O elf32-littleriscv shell.bin shell.bin.o
 
 # 構建內核，並將用戶程序 (shell.bin.o) 嵌入內核映像中
-$CC $CFLAGS -Wl,-Tkernel.ld -Wl,-Map=kernel.map -o kernel.elf kernel.c mm.c virtio.c common.c shell.bin.o
+$CC $CFLAGS -Wl,-Tkernel.ld -Wl,-Map=kernel.map -o kernel.elf kernel.c console.c mm.c virtio.c virtio_console.c bcache.c llm.c llm_cache.c uring.c fs.c common.c shell.bin.o
+
+# 磁碟前面是 LLM 請求環（2 個 header + 8 個槽位 × 72 個磁區，約 289KB），
+# 320KB 開始是檔案系統（FS_BASE_SECTOR）。還沒有檔案系統時用 disk/ 的內容建立，
+# 已經有的話 mkfs.py 不會動它；要重建請加 --force
+python3 mkfs.py lorem.txt disk/*
 
 # 啟動 QEMU，運行內核映像
 $QEMU -machine virt \
+      -smp $SMP \
       -bios default \
       -nographic \
       -serial mon:stdio \
@@ -37,5 +57,6 @@ $QEMU -machine virt \
       -d unimp,guest_errors,int,cpu_reset -D qemu.log \
       -drive id=drive0,file=lorem.txt,format=raw,if=none \
       -device virtio-blk-device,drive=drive0,bus=virtio-mmio-bus.0 \
+      ${LLM_ARGS[@]+"${LLM_ARGS[@]}"} \
       -kernel kernel.elf
 
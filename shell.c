@@ -1,20 +1,8 @@
 #include "user.h"
 
-void delay() {
-    for (volatile int i = 0; i < 100000; ++i);
-}
-
-// 顯示游標
-void show_cursor(void) {
-    putchar('_');
-}
-
-// 隱藏游標
-void hide_cursor(void) {
-    putchar('\b');  // 退格
-    putchar(' ');   // 空格覆蓋
-    putchar('\b');  // 再退格
-}
+// bench.c
+void bench_main(void);
+void ring_bench_main(void);
 
 // 簡單的 LLM 回應函數
 void llm_response(const char *input) {
@@ -37,21 +25,25 @@ void llm_response(const char *input) {
 }
 
 // LLM 對話模式相關函數
+#define LLM_WAIT_TIMEOUT_MS 20000
+
 void llm_mode() {
     printf("\n=== LLM 對話模式 ===\n");
     printf("輸入 !exit 退出對話模式\n");
     printf("輸入 !help 查看幫助\n");
     printf("輸入 !status 查看連接狀態\n\n");
 
-    char input[LLM_MAX_MSG_SIZE];
-    char response[LLM_MAX_MSG_SIZE];
+    // 回應可達數十 KB，放在 bss 而不是使用者堆疊上
+    static char input[LLM_MAX_REQUEST_SIZE];
+    static char response[LLM_MAX_RESPONSE_SIZE];
 
     while (1) {
         printf("AI> ");
 
         // 讀取用戶輸入
         int i = 0;
-        while (i < LLM_MAX_MSG_SIZE - 1) {
+        input[LLM_MAX_REQUEST_SIZE - 1] = '\0'; // 輸入到上限時沒有經過 Enter
+        while (i < LLM_MAX_REQUEST_SIZE - 1) {
             int ch = getchar();
             if (ch == '\n' || ch == '\r') { // 支援 Enter
                 input[i] = '\0';
@@ -79,17 +71,17 @@ void llm_mode() {
             printf("- !help: 顯示此幫助\n");
             printf("- !status: 查看連接狀態\n");
             printf("- 支援中文和英文輸入\n");
-            printf("- 使用 Host-Guest 檔案交換機制\n\n");
+            printf("- 使用 Host-Guest 檔案交換機制，回應邊產生邊顯示\n\n");
             continue;
         }
 
         // 檢查狀態命令
         if (strcmp(input, "!status") == 0) {
             printf("\n=== 連接狀態 ===\n");
-            printf("使用 VirtIO 磁碟檔案交換\n");
-            printf("Sector 0: 請求檔案\n");
-            printf("Sector 1: 回應檔案\n");
-            printf("Sector 2: 狀態檔案\n");
+            printf("使用 VirtIO 磁碟上的請求環交換\n");
+            printf("Sector 0: guest header（送出的請求）\n");
+            printf("Sector 1: host header（已回應的請求）\n");
+            printf("Sector 2 起: 每個槽位一個請求區、一個回應區（含長度與 CRC 的訊框）\n");
             printf("請確保 Host 端 Python 服務正在運行\n\n");
             continue;
         }
@@ -101,37 +93,141 @@ void llm_mode() {
 
         // 發送請求到 Host 端
         printf("\n[發送請求中...]\n");
-        int send_result = syscall(200, (int)input, 0, 0); // SYS_LLM_SEND_REQUEST
+        int request_id = syscall(200, (int)input, 0, 0); // SYS_LLM_SEND_REQUEST
 
-        if (send_result != 0) {
-            printf("錯誤：無法發送請求\n\n");
+        if (request_id < 0) {
+            printf("錯誤：無法發送請求（請求環已滿？）\n\n");
             continue;
         }
 
-        // 等待回應
-        printf("[等待回應中...]\n");
-        int retry_count = 0;
-        int has_response = 0;
+        // 串流接收回應：host 每寫入一段就印出一段，沒有新內容時在核心裡睡著等
+        printf("AI: ");
+        int offset = 0;
+        int n = 0;
 
-        while (retry_count < 20000) { // 最多等待 20 秒
-            has_response = syscall(201, (int)response, 0, 0); // SYS_LLM_GET_RESPONSE
-            if (has_response) {
+        while (1) {
+            n = syscall(SYS_LLM_STREAM, (int)response, request_id, offset);
+            if (n == LLM_STREAM_DONE || n < 0) {
                 break;
             }
-            // 簡單延遲
-            for (volatile int i = 0; i < 1000000; i++);
-            retry_count++;
+            if (n > 0) {
+                printf("%s", response);
+                offset += n;
+                continue;
+            }
+            // 最多 LLM_WAIT_TIMEOUT_MS 沒有新內容就放棄
+            int ready = syscall(SYS_LLM_WAIT, request_id, offset, LLM_WAIT_TIMEOUT_MS);
+            if (ready <= 0) {
+                n = ready;
+                break;
+            }
+        }
+        if (n == 0) {
+            syscall(SYS_LLM_CANCEL, request_id, 0, 0); // 放掉槽位，host 也不必再產生
         }
 
-        if (has_response) {
-            printf("\nAI: %s\n\n", response);
+        if (n == LLM_STREAM_DONE) {
+            printf("\n\n");
+        } else if (n < 0) {
+            printf("\n錯誤：請求 %d 已失效\n\n", request_id);
+        } else if (offset == 0) {
+            printf("抱歉，沒有收到回應。請檢查 Host 端服務是否正在運行。\n\n");
         } else {
-            printf("\nAI: 抱歉，沒有收到回應。請檢查 Host 端服務是否正在運行。\n\n");
+            printf("\n[回應逾時，內容可能不完整]\n\n");
+        }
+    }
+}
+
+// 解析十進位數字，遇到非數字即停止
+int parse_int(const char *s) {
+    int value = 0;
+    while (*s >= '0' && *s <= '9')
+        value = value * 10 + (*s++ - '0');
+    return value;
+}
+
+// spawn 出來的子進程：做一小段計算後以 arg 作為結束碼
+int worker_main(int arg) {
+    volatile uint32_t sum = 0;
+    for (int i = 0; i < 100000; i++)
+        sum += i;
+    return arg;
+}
+
+// 反覆產生與回收子進程，每批最多 SPAWN_BATCH 個同時存在
+#define SPAWN_BATCH 4
+void spawn_test(int n) {
+    int done = 0;
+    while (done < n) {
+        int batch = n - done < SPAWN_BATCH ? n - done : SPAWN_BATCH;
+        int started = 0;
+        for (int i = 0; i < batch; i++) {
+            if (spawn(done + i + 1) < 0) {
+                printf("spawn failed\n");
+                break;
+            }
+            started++;
         }
+        for (int i = 0; i < started; i++) {
+            int status;
+            int pid = wait(-1, &status);
+            if (pid < 0)
+                break;
+        }
+        if (started == 0)
+            break;
+        done += started;
     }
+    printf("spawned and reaped %d processes\n", done);
 }
 
-void main(void) {
+void list_files(void) {
+    struct fs_dirent ents[16];
+    int n = listdir(ents, 16);
+    for (int i = 0; i < n && i < 16; i++)
+        printf("%s\t%d bytes\n", ents[i].name, ents[i].size);
+    if (n > 16)
+        printf("... (%d files)\n", n);
+}
+
+void cat_file(const char *name) {
+    int fd = open(name, 0);
+    if (fd < 0) {
+        printf("no such file: %s\n", name);
+        return;
+    }
+    char buf[128];
+    int n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (int i = 0; i < n; i++)
+            putchar(buf[i]);
+    }
+    printf("\n");
+    close(fd);
+}
+
+// args 為「檔名 內容」，覆寫整個檔案（不存在時建立）
+void write_file(char *args) {
+    char *text = args;
+    while (*text && *text != ' ')
+        text++;
+    if (*text)
+        *text++ = '\0';
+    int fd = open(args, O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        printf("cannot open %s\n", args);
+        return;
+    }
+    int len = strlen(text);
+    if (write(fd, text, len) != len)
+        printf("disk is full, wrote only part of it\n");
+    close(fd);
+}
+
+int main(int arg) {
+    if (arg != 0)
+        return worker_main(arg);
+
     int in_llm_mode = 0;  // LLM 模式狀態
 
     while (1) {
@@ -144,51 +240,26 @@ prompt:
 
         char cmdline[128];
         int i = 0;
-        int cursor_visible = 0;
-        int blink = 0;
-        show_cursor();
-        cursor_visible = 1;
-
         while (1) {
-            int ch = getchar_nonblock();
-            if (ch >= 0) {
-                if (cursor_visible) {
-                    hide_cursor();
-                    cursor_visible = 0;
-                }
-                if (ch == '\r') {
-                    printf("\n");
-                    cmdline[i] = '\0';
-                    break;
-                } else if (ch == '\b' || ch == 127) { // 退格鍵
-                    if (i > 0) {
-                        i--;
-                        putchar('\b');
-                        putchar(' ');
-                        putchar('\b');
-                    }
-                } else if (i == sizeof(cmdline) - 1) {
-                    printf("command line too long\n");
-                    goto prompt;
-                } else {
-                    putchar(ch);
-                    cmdline[i++] = ch;
+            // 沒有輸入時在核心裡睡眠，由 UART 中斷喚醒
+            int ch = getchar();
+            if (ch == '\r') {
+                printf("\n");
+                cmdline[i] = '\0';
+                break;
+            } else if (ch == '\b' || ch == 127) { // 退格鍵
+                if (i > 0) {
+                    i--;
+                    putchar('\b');
+                    putchar(' ');
+                    putchar('\b');
                 }
-                show_cursor();
-                cursor_visible = 1;
+            } else if (i == sizeof(cmdline) - 1) {
+                printf("command line too long\n");
+                goto prompt;
             } else {
-                delay();
-                blink++;
-                if (blink > 100) { // 1秒左右閃一次
-                    if (cursor_visible) {
-                        hide_cursor();
-                        cursor_visible = 0;
-                    } else {
-                        show_cursor();
-                        cursor_visible = 1;
-                    }
-                    blink = 0;
-                }
+                putchar(ch);
+                cmdline[i++] = ch;
             }
         }
 
@@ -206,22 +277,105 @@ prompt:
             if (strcmp(cmdline, "hello") == 0)
                 printf("Hello world from shell!\n");
             else if (strcmp(cmdline, "exit") == 0)
-                exit();
+                exit(0);
             else if (strcmp(cmdline, "help") == 0) {
                 printf("\n=== RISC-V OS Shell 命令說明 ===\n");
                 printf("hello  - 顯示歡迎訊息\n");
                 printf("exit   - 結束程式\n");
                 printf("help   - 顯示此說明\n");
                 printf("llm    - 進入 AI 對話模式\n");
+                printf("sync   - 將檔案與磁區快取寫回磁碟\n");
+                printf("ls     - 列出檔案\n");
+                printf("cat F  - 顯示檔案 F 的內容\n");
+                printf("write F TEXT - 把 TEXT 寫進檔案 F（sync 後才會存到磁碟）\n");
+                printf("cache  - 顯示磁區快取統計\n");
+                printf("llmcache [ttl N] - 顯示 LLM 回應快取統計，或設定保留秒數（0 為不過期）\n");
+                printf("mem    - 顯示實體記憶體配置統計\n");
+                printf("spawn N - 產生並回收 N 個子進程\n");
+                printf("ps     - 顯示進程統計\n");
+                printf("slice [N] - 查詢或設定時間片長度 (ms)\n");
+                printf("cpus   - 顯示每個 hart 的使用率\n");
+                printf("bench  - 量測 memcpy/memset/strlen/strcmp 的速度\n");
+                printf("bench ring - 比較逐一 syscall 與經由提交環的成本\n");
                 printf("\n=== LLM 檔案系統 ===\n");
-                printf("LLM 使用 VirtIO 磁碟進行檔案交換：\n");
-                printf("- 磁區 0: llm_request.txt (請求檔案)\n");
-                printf("- 磁區 1: llm_response.txt (回應檔案)\n");
-                printf("- 磁區 2: llm_status.txt (狀態檔案)\n");
+                printf("LLM 使用 VirtIO 磁碟上的請求環交換，可同時有多個請求：\n");
+                printf("- 磁區 0: guest header (producer 與各槽位的請求 ID)\n");
+                printf("- 磁區 1: host header (consumer 與各槽位的回應 ID)\n");
+                printf("- 磁區 2 起: 每個槽位的請求與回應\n");
+                printf("- 磁區 640 (320KB) 起: 檔案系統 (superblock、bitmap、inode 表、資料)\n");
             }
             else if (strcmp(cmdline, "llm") == 0) {
                 llm_mode();
             }
+            else if (strcmp(cmdline, "sync") == 0) {
+                if (syscall(SYS_SYNC, 0, 0, 0) < 0)
+                    printf("sync: some data could not be written to disk\n");
+            }
+            else if (strcmp(cmdline, "ls") == 0) {
+                list_files();
+            }
+            else if (strstr(cmdline, "cat ") == cmdline) {
+                cat_file(cmdline + 4);
+            }
+            else if (strstr(cmdline, "write ") == cmdline) {
+                write_file(cmdline + 6);
+            }
+            else if (strcmp(cmdline, "cache") == 0) {
+                struct bcache_stats st;
+                syscall(SYS_BCACHE_STATS, (int) &st, 0, 0);
+                printf("hits=%d misses=%d evictions=%d writebacks=%d\n",
+                       st.hits, st.misses, st.evictions, st.writebacks);
+            }
+            else if (strcmp(cmdline, "llmcache") == 0) {
+                struct llm_cache_stats st;
+                syscall(SYS_LLM_CACHE_STATS, (int) &st, 0, 0);
+                printf("hits=%d misses=%d entries=%d pages=%d evictions=%d expired=%d ttl=%ds\n",
+                       st.hits, st.misses, st.entries, st.pages, st.evictions, st.expired,
+                       st.ttl);
+            }
+            else if (strstr(cmdline, "llmcache ttl ") == cmdline) {
+                int seconds = parse_int(cmdline + 13);
+                int old = syscall(SYS_LLM_CACHE_TTL, seconds, 0, 0);
+                printf("llm cache ttl: %d s -> %d s\n", old, seconds);
+            }
+            else if (strcmp(cmdline, "mem") == 0) {
+                struct mm_stats st;
+                syscall(SYS_MEM_STATS, (int) &st, 0, 0);
+                printf("free=%d/%d pages largest=%d fragmentation=%d%%\n",
+                       st.free_pages, st.total_pages, st.largest_free_block,
+                       st.fragmentation);
+            }
+            else if (strstr(cmdline, "spawn ") == cmdline) {
+                spawn_test(parse_int(cmdline + 6));
+            }
+            else if (strcmp(cmdline, "slice") == 0 || strstr(cmdline, "slice ") == cmdline) {
+                int ms = cmdline[5] ? parse_int(cmdline + 6) : 0;
+                int old_ms = syscall(SYS_SET_TIME_SLICE, ms, 0, 0);
+                if (ms > 0)
+                    printf("time slice: %d ms -> %d ms\n", old_ms, ms);
+                else
+                    printf("time slice: %d ms\n", old_ms);
+            }
+            else if (strcmp(cmdline, "ps") == 0) {
+                struct proc_stats st;
+                syscall(SYS_PROC_STATS, (int) &st, 0, 0);
+                printf("live=%d zombie=%d created=%d reaped=%d\n",
+                       st.live, st.zombie, st.created, st.reaped);
+            }
+            else if (strcmp(cmdline, "bench") == 0) {
+                bench_main();
+            }
+            else if (strcmp(cmdline, "bench ring") == 0) {
+                ring_bench_main();
+            }
+            else if (strcmp(cmdline, "cpus") == 0) {
+                struct cpu_stats st[CPUS_MAX];
+                int n = syscall(SYS_CPU_STATS, (int) st, CPUS_MAX, 0);
+                for (int i = 0; i < n; i++) {
+                    printf("hart %d: busy=%d%% switches=%d pid=%d\n", st[i].hartid,
+                           st[i].busy_percent, st[i].context_switches, st[i].pid);
+                }
+            }
             else
                 printf("unknown command: %s\n", cmdline);
         }
@@ -0,0 +1,88 @@
+#include "kernel.h"
+#include "common.h"
+#include "llm.h"
+#include "uring.h"
+
+// 類似 io_uring 的提交/完成環：一次 SYS_URING_ENTER（或 SQPOLL 模式下的中斷）
+// 處理一整批操作，陷入核心的成本由整批分攤。操作都在呼叫者的進程脈絡中
+// 依序同步執行，可以睡眠（磁碟 I/O）。
+
+// 為目前進程映射環並回傳它的使用者位址；已經有環時只更新 flags
+int uring_setup(struct process *proc, int flags) {
+    if (!proc->uring) {
+        paddr_t page = alloc_pages(1); // 已清零，四個索引都從 0 開始
+        map_page(proc->page_table, URING_VADDR, page, PAGE_U | PAGE_R | PAGE_W);
+        __asm__ __volatile__("sfence.vma");
+        // 頁面掛在使用者頁表上，進程結束時由 unmap_user_pages 釋放
+        proc->uring = (struct uring *) page;
+    }
+    proc->uring_sqpoll = (flags & URING_SETUP_SQPOLL) != 0;
+    return URING_VADDR;
+}
+
+// 整段都必須是使用者可讀的頁面，否則任何進程都能透過環印出核心記憶體
+static int uring_console_write(struct process *proc, vaddr_t addr, uint32_t len) {
+    if (addr + len < addr)
+        return -1;
+    for (vaddr_t page = addr & ~(PAGE_SIZE - 1); page < addr + len; page += PAGE_SIZE) {
+        if (!walk_page(proc->page_table, page, PAGE_U | PAGE_R))
+            return -1;
+    }
+    for (uint32_t i = 0; i < len; i++)
+        putchar(((const char *) addr)[i]);
+    return len;
+}
+
+static int uring_exec(struct process *proc, const struct uring_sqe *sqe) {
+    switch (sqe->opcode) {
+        case URING_OP_NOP:
+            return 0;
+        case URING_OP_DISK_READ:
+        case URING_OP_DISK_WRITE:
+            return user_raw_disk_rw(sqe->addr, sqe->arg, sqe->len,
+                                    sqe->opcode == URING_OP_DISK_WRITE);
+        case URING_OP_CONSOLE_WRITE:
+            return uring_console_write(proc, sqe->addr, sqe->len);
+        case URING_OP_LLM_SEND:
+            return llm_submit(sqe->addr);
+        case URING_OP_LLM_POLL:
+            return llm_poll(sqe->addr, sqe->arg);
+        case URING_OP_LLM_STREAM:
+            return llm_stream(sqe->addr, sqe->arg, sqe->len);
+        default:
+            return -1;
+    }
+}
+
+// 依序執行提交環上的操作，完成環滿了就停下。回傳執行的操作數，沒有環時回傳 -1。
+// 索引由使用者寫，每次都只讀一次；sqe 先複製出來，執行期間使用者改它也無妨。
+int uring_enter(struct process *proc) {
+    struct uring *r = proc->uring;
+    if (!r)
+        return -1;
+
+    int n = 0;
+    uint32_t head = r->sq_head;
+    uint32_t tail = r->sq_tail;
+    // sq_tail 亂寫時最多處理一圈
+    while (head != tail && n < URING_ENTRIES
+           && r->cq_tail - r->cq_head < URING_ENTRIES) {
+        __sync_synchronize(); // 看到 sq_tail 之後才讀 sqe
+        struct uring_sqe sqe = r->sq[head % URING_ENTRIES];
+        r->sq_head = ++head;
+
+        struct uring_cqe *cqe = &r->cq[r->cq_tail % URING_ENTRIES];
+        cqe->user_data = sqe.user_data;
+        cqe->result = uring_exec(proc, &sqe);
+        __sync_synchronize(); // cqe 寫好之後才讓使用者看到
+        r->cq_tail++;
+        n++;
+    }
+    return n;
+}
+
+// 中斷處理完、回到使用者模式之前呼叫：SQPOLL 模式下順便處理提交環
+void uring_sqpoll(struct process *proc) {
+    if (proc->uring && proc->uring_sqpoll && proc->uring->sq_head != proc->uring->sq_tail)
+        uring_enter(proc);
+}
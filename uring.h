@@ -0,0 +1,8 @@
+#pragma once
+#include "common.h"
+
+struct process;
+
+int uring_setup(struct process *proc, int flags);
+int uring_enter(struct process *proc);
+void uring_sqpoll(struct process *proc);
@@ -1,10 +1,8 @@
 #include "user.h"
 
-extern char __stack_top[];
-
 /* exit 函數，當程序結束時進入無限循環 */
-__attribute__((noreturn)) void exit(void) {
-	syscall(SYS_EXIT, 0, 0, 0);
+__attribute__((noreturn)) void exit(int status) {
+	syscall(SYS_EXIT, status, 0, 0);
     for (;;);
 }
 
@@ -34,15 +32,81 @@ int getchar_nonblock(void) {
     return syscall(SYS_GETCHAR_NONBLOCK, 0, 0, 0);
 }
 
-/* 程序入口函數 start，放到 .text.start 段 */
+int spawn(int arg) {
+    return syscall(SYS_SPAWN, arg, 0, 0);
+}
+
+int wait(int pid, int *status) {
+    return syscall(SYS_WAIT, pid, (int) status, 0);
+}
+
+int open(const char *path, int flags) {
+    return syscall(SYS_OPEN, (int) path, flags, 0);
+}
+
+int read(int fd, void *buf, int len) {
+    return syscall(SYS_READ, fd, (int) buf, len);
+}
+
+int write(int fd, const void *buf, int len) {
+    return syscall(SYS_WRITE, fd, (int) buf, len);
+}
+
+int close(int fd) {
+    return syscall(SYS_CLOSE, fd, 0, 0);
+}
+
+// 回傳檔案總數，最多填 max 個項目
+int listdir(struct fs_dirent *ents, int max) {
+    return syscall(SYS_LIST, (int) ents, max, 0);
+}
+
+struct uring *uring_setup(int flags) {
+    return (struct uring *) syscall(SYS_URING_SETUP, flags, 0, 0);
+}
+
+// 在提交環上排一個操作（還不會執行）；提交環滿了回傳 -1
+int uring_prep(struct uring *r, uint32_t opcode, const void *addr, uint32_t len,
+               uint32_t arg, uint32_t user_data) {
+    uint32_t tail = r->sq_tail;
+    if (tail - r->sq_head >= URING_ENTRIES)
+        return -1;
+    struct uring_sqe *sqe = &r->sq[tail % URING_ENTRIES];
+    sqe->opcode = opcode;
+    sqe->addr = (uint32_t) addr;
+    sqe->len = len;
+    sqe->arg = arg;
+    sqe->user_data = user_data;
+    __sync_synchronize(); // sqe 寫好之後核心才看得到新的 sq_tail
+    r->sq_tail = tail + 1;
+    return 0;
+}
+
+// 一次陷入核心處理所有排好的操作，回傳處理的數量
+int uring_enter(void) {
+    return syscall(SYS_URING_ENTER, 0, 0, 0);
+}
+
+// 取出一個完成的結果；沒有時回傳 0
+int uring_reap(struct uring *r, struct uring_cqe *cqe) {
+    uint32_t head = r->cq_head;
+    if (head == r->cq_tail)
+        return 0;
+    __sync_synchronize();
+    *cqe = r->cq[head % URING_ENTRIES];
+    r->cq_head = head + 1;
+    return 1;
+}
+
+/* 程序入口函數 start，放到 .text.start 段。
+ * 核心把 spawn 的參數放在 a0，原封不動交給 main，main 的回傳值即結束碼。 */
 __attribute__((section(".text.start")))
 __attribute__((naked))
 void start(void) {
     __asm__ volatile (
-        "mv sp, %[stack_top] \n"  /* 將棧指針設置為 __stack_top */
-        "call main           \n"  /* 調用 main 函數 */
-        "call exit           \n"  /* 調用 exit 函數結束程序 */
-        :: [stack_top] "r" (__stack_top)
+        "la sp, __stack_top \n"  /* 將棧指針設置為 __stack_top（不動到 a0） */
+        "call main          \n"  /* 調用 main 函數 */
+        "call exit          \n"  /* 調用 exit 函數結束程序 */
     );
 }
 
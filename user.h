@@ -5,6 +5,20 @@ int getchar(void);
 int getchar_nonblock(void);
 int syscall(int sysno, int arg0, int arg1, int arg2);
 
-__attribute__((noreturn)) void exit(void);
+__attribute__((noreturn)) void exit(int status);
+int spawn(int arg);
+int wait(int pid, int *status);
 void putchar(char ch);
 
+int open(const char *path, int flags);
+int read(int fd, void *buf, int len);
+int write(int fd, const void *buf, int len);
+int close(int fd);
+int listdir(struct fs_dirent *ents, int max);
+
+struct uring *uring_setup(int flags);
+int uring_prep(struct uring *r, uint32_t opcode, const void *addr, uint32_t len,
+               uint32_t arg, uint32_t user_data);
+int uring_enter(void);
+int uring_reap(struct uring *r, struct uring_cqe *cqe);
+
@@ -1,64 +1,54 @@
 #!/usr/bin/env python3
 """
-LLM 檔案交換流程驗證工具
-確認 OS -> Python -> OS 的完整檔案交換流程
+LLM 請求環流程驗證工具
+確認 OS -> Python -> OS 的完整交換流程（格式見 llm_ring.py）
 """
 
-import os
 import time
-import threading
 
-SECTOR_SIZE = 512
+from llm_ring import (GUEST_MAGIC, MAX_REQUEST_SIZE, MAX_RESPONSE_SIZE, RING_SLOTS,
+                      GuestHeader, HostHeader, RingDisk, req_sector, resp_sector,
+                      slot_of)
 
 class LLMFlowVerifier:
     def __init__(self, disk_file="lorem.txt"):
-        self.disk_file = disk_file
+        self.disk = RingDisk(disk_file)
         self.monitoring = False
 
-    def read_sector(self, sector_num: int) -> bytes:
-        """讀取指定 sector 的內容"""
-        with open(self.disk_file, 'rb') as f:
-            f.seek(sector_num * SECTOR_SIZE)
-            return f.read(SECTOR_SIZE)
-
-    def get_sector_text(self, sector_num: int) -> str:
-        """讀取 sector 的文字內容"""
-        data = self.read_sector(sector_num)
-        null_pos = data.find(b'\x00')
-        if null_pos == -1:
-            null_pos = len(data)
-        return data[:null_pos].decode('utf-8', errors='ignore')
-
     def monitor_files(self):
-        """監控檔案變化"""
-        print("=== 開始監控 LLM 檔案交換 ===")
+        """監控 producer / consumer 的變化"""
+        print("=== 開始監控 LLM 請求環 ===")
         print("等待 OS 端發送請求...")
 
-        last_request = ""
-        last_response = ""
-        last_status = ""
+        last_producer = 0
+        last_consumer = 0
+        last_epoch = None
 
         while self.monitoring:
             try:
-                # 讀取當前狀態
-                current_request = self.get_sector_text(0)
-                current_response = self.get_sector_text(1)
-                current_status = self.get_sector_text(2)
+                guest = self.disk.read_guest_header()
+                host = self.disk.read_host_header()
 
-                # 檢查是否有新請求
-                if current_request != last_request and current_request.strip():
-                    print(f"\n📤 [OS -> Python] 新請求: {current_request}")
-                    last_request = current_request
+                if guest.epoch != last_epoch:
+                    print(f"\n🔄 guest epoch: {last_epoch} -> {guest.epoch}")
+                    last_epoch = guest.epoch
+                    last_producer = last_consumer = 0
 
-                # 檢查狀態變化
-                if current_status != last_status:
-                    print(f"🔄 狀態變化: '{last_status}' -> '{current_status}'")
-                    last_status = current_status
+                # 檢查是否有新請求
+                while last_producer < guest.producer:
+                    last_producer += 1
+                    slot = slot_of(last_producer)
+                    text = self.read_text(req_sector(slot), last_producer, MAX_REQUEST_SIZE)
+                    print(f"\n📤 [OS -> Python] 請求 #{last_producer}（槽位 {slot}）: {text}")
 
                 # 檢查是否有新回應
-                if current_response != last_response and current_response.strip():
-                    print(f"📥 [Python -> OS] 新回應: {current_response}")
-                    last_response = current_response
+                if host.epoch == guest.epoch:
+                    while last_consumer < host.consumer:
+                        last_consumer += 1
+                        slot = slot_of(last_consumer)
+                        text = self.read_text(resp_sector(slot), last_consumer,
+                                              MAX_RESPONSE_SIZE)
+                        print(f"📥 [Python -> OS] 回應 #{last_consumer}: {text}")
 
                 time.sleep(0.1)
 
@@ -69,6 +59,12 @@ class LLMFlowVerifier:
                 print(f"監控錯誤: {e}")
                 time.sleep(1)
 
+    def read_text(self, area: int, msg_id: int, max_size: int) -> str:
+        try:
+            return self.disk.read_text(area, msg_id, max_size)
+        except ValueError as e:
+            return f"[訊框無效] {e}"
+
     def start_monitoring(self):
         """開始監控"""
         self.monitoring = True
@@ -79,61 +75,79 @@ class LLMFlowVerifier:
         self.monitoring = False
 
     def show_current_state(self):
-        """顯示當前狀態"""
-        print("\n=== 當前檔案狀態 ===")
-        print(f"Sector 0 (請求): '{self.get_sector_text(0)}'")
-        print(f"Sector 1 (回應): '{self.get_sector_text(1)}'")
-        print(f"Sector 2 (狀態): '{self.get_sector_text(2)}'")
+        """顯示兩個 header 與每個槽位的狀態"""
+        guest = self.disk.read_guest_header()
+        host = self.disk.read_host_header()
+        print("\n=== 當前請求環狀態 ===")
+        print(f"Guest header: magic={guest.magic:#x} epoch={guest.epoch} "
+              f"producer={guest.producer} {'有效' if guest.valid else '無效'}")
+        print(f"Host header:  magic={host.magic:#x} epoch={host.epoch} "
+              f"consumer={host.consumer}")
+        for slot in range(RING_SLOTS):
+            if not guest.req_id[slot]:
+                continue
+            state = "等待中"
+            if host.epoch == guest.epoch and host.resp_id[slot] == guest.req_id[slot]:
+                state = f"回應中（{host.resp_len[slot]} bytes）"
+                if host.resp_done[slot] == guest.req_id[slot]:
+                    state = f"已回應（{host.resp_len[slot]} bytes）"
+            print(f"  槽位 {slot}: 請求 #{guest.req_id[slot]} "
+                  f"({guest.req_len[slot]} bytes) {state}")
 
     def test_manual_flow(self):
-        """手動測試檔案交換流程"""
-        print("\n=== 手動測試檔案交換 ===")
+        """手動走一次請求環：guest 送出、host 回應、guest 讀回"""
+        print("\n=== 手動測試請求環 ===")
 
-        # 模擬 OS 發送請求
+        # 模擬 OS 開機並發送請求
         print("1. 模擬 OS 發送請求...")
-        self.write_sector(0, "測試請求：你好".encode("utf-8"))
-        self.write_sector(2, b"request_sent")
-        print("   ✅ 請求已寫入 Sector 0")
-        print("   ✅ 狀態已設為 'request_sent'")
+        guest = self.disk.read_guest_header()
+        if not guest.valid:
+            guest = GuestHeader(GUEST_MAGIC, 1, RING_SLOTS)
+        request_id = guest.producer + 1
+        slot = slot_of(request_id)
+        guest.req_len[slot] = self.disk.write_text(req_sector(slot), request_id,
+                                                   "測試請求：你好", MAX_REQUEST_SIZE)
+        guest.req_id[slot] = request_id
+        guest.producer = request_id
+        self.disk.write_sector(0, guest.pack())
+        print(f"   ✅ 請求 #{request_id} 已寫入槽位 {slot}（Sector {req_sector(slot)}）")
 
         time.sleep(1)
 
         # 模擬 Python 處理回應
         print("\n2. 模擬 Python 處理回應...")
-        self.write_sector(1, "你好！我是 AI 助手，很高興為你服務！".encode("utf-8"))
-        self.write_sector(2, b"response_ready")
-        print("   ✅ 回應已寫入 Sector 1")
-        print("   ✅ 狀態已設為 'response_ready'")
+        host = self.disk.read_host_header()
+        if host.epoch != guest.epoch:
+            host = HostHeader(epoch=guest.epoch)
+        host.resp_len[slot] = self.disk.write_text(
+            resp_sector(slot), request_id, "你好！我是 AI 助手，很高興為你服務！" * 40,
+            MAX_RESPONSE_SIZE)
+        host.resp_id[slot] = request_id
+        host.resp_done[slot] = request_id
+        host.consumer = request_id
+        self.disk.write_host_header(host)
+        print(f"   ✅ 回應已寫入 Sector {resp_sector(slot)}，consumer = {request_id}")
 
         time.sleep(1)
 
         # 模擬 OS 讀取回應
         print("\n3. 模擬 OS 讀取回應...")
-        self.write_sector(2, b"idle")
-        print("   ✅ 狀態已設為 'idle'")
+        host = self.disk.read_host_header()
+        ok = host.resp_done[slot] == request_id
+        text = self.read_text(resp_sector(slot), request_id, MAX_RESPONSE_SIZE)
+        ok = ok and len(text.encode('utf-8')) == host.resp_len[slot]
+        print(f"   {'✅' if ok else '❌'} 回應 #{host.resp_id[slot]}"
+              f"（{host.resp_len[slot]} bytes）: {text[:40]}...")
 
         print("\n=== 測試完成 ===")
 
-    def write_sector(self, sector_num: int, data: bytes):
-        """寫入資料到指定 sector"""
-        if len(data) > SECTOR_SIZE:
-            data = data[:SECTOR_SIZE]
-        elif len(data) < SECTOR_SIZE:
-            data = data.ljust(SECTOR_SIZE, b'\x00')
-
-        with open(self.disk_file, 'r+b') as f:
-            f.seek(sector_num * SECTOR_SIZE)
-            f.write(data)
-            f.flush()
-            os.fsync(f.fileno())
-
 def main():
     verifier = LLMFlowVerifier()
 
-    print("LLM 檔案交換流程驗證工具")
+    print("LLM 請求環流程驗證工具")
     print("1. 顯示當前狀態")
-    print("2. 開始監控檔案變化")
-    print("3. 手動測試檔案交換")
+    print("2. 開始監控請求環")
+    print("3. 手動測試請求環")
     print("4. 退出")
 
     while True:
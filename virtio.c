@@ -1,103 +1,311 @@
 #include "kernel.h"
 #include "common.h"
 
-uint32_t virtio_reg_read32(unsigned offset) {
-    return *((volatile uint32_t *) (VIRTIO_BLK_PADDR + offset));
+// virtio-mmio 暫存器存取；base 為裝置所在的 MMIO 槽位
+uint32_t virtio_reg_read32(paddr_t base, unsigned offset) {
+    return *((volatile uint32_t *) (base + offset));
 }
 
-uint64_t virtio_reg_read64(unsigned offset) {
-    return *((volatile uint64_t *) (VIRTIO_BLK_PADDR + offset));
+uint64_t virtio_reg_read64(paddr_t base, unsigned offset) {
+    return *((volatile uint64_t *) (base + offset));
 }
 
-void virtio_reg_write32(unsigned offset, uint32_t value) {
-    *((volatile uint32_t *) (VIRTIO_BLK_PADDR + offset)) = value;
+void virtio_reg_write32(paddr_t base, unsigned offset, uint32_t value) {
+    *((volatile uint32_t *) (base + offset)) = value;
 }
 
-void virtio_reg_fetch_and_or32(unsigned offset, uint32_t value) {
-    virtio_reg_write32(offset, virtio_reg_read32(offset) | value);
+void virtio_reg_fetch_and_or32(paddr_t base, unsigned offset, uint32_t value) {
+    virtio_reg_write32(base, offset, virtio_reg_read32(base, offset) | value);
+}
+
+// 槽位上是否有指定種類的 legacy virtio 裝置（沒接裝置的槽位 device id 為 0）
+bool virtio_device_present(paddr_t base, uint32_t device_id) {
+    return virtio_reg_read32(base, VIRTIO_REG_MAGIC) == 0x74726976
+           && virtio_reg_read32(base, VIRTIO_REG_VERSION) == 1
+           && virtio_reg_read32(base, VIRTIO_REG_DEVICE_ID) == device_id;
+}
+
+// 重設裝置並走到 FEATURES_OK（不協商任何 feature）；接著設定 virtqueue，
+// 最後寫入 VIRTIO_STATUS_DRIVER_OK
+void virtio_device_begin(paddr_t base) {
+    virtio_reg_write32(base, VIRTIO_REG_DEVICE_STATUS, 0);
+    virtio_reg_fetch_and_or32(base, VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACK);
+    virtio_reg_fetch_and_or32(base, VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_DRIVER);
+    virtio_reg_fetch_and_or32(base, VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FEAT_OK);
 }
 
 struct virtio_virtq *blk_request_vq;
-struct virtio_blk_req *blk_req;
-paddr_t blk_req_paddr;
+struct virtio_blk_req *blk_reqs;      // 請求標頭池，與 blk_inflight 以索引對應
+paddr_t blk_reqs_paddr;
 unsigned blk_capacity;
+static struct blk_request blk_inflight[VIRTIO_BLK_REQ_MAX];
+static struct blk_request *blk_desc_owner[VIRTQ_ENTRY_NUM]; // head descriptor -> 請求
+static int blk_pending_notify;         // 已放入 avail ring 但尚未通知裝置的請求數
+static struct wait_queue blk_wait_queue;
+// 保護 virtqueue、請求池與 blk_pending_notify；完成中斷可能由任何一個 hart 處理
+static struct spinlock blk_lock;
 
 void virtio_blk_init(void) {
-    if (virtio_reg_read32(VIRTIO_REG_MAGIC) != 0x74726976)
+    if (virtio_reg_read32(VIRTIO_BLK_PADDR, VIRTIO_REG_MAGIC) != 0x74726976)
         PANIC("virtio: invalid magic value");
-    if (virtio_reg_read32(VIRTIO_REG_VERSION) != 1)
+    if (virtio_reg_read32(VIRTIO_BLK_PADDR, VIRTIO_REG_VERSION) != 1)
         PANIC("virtio: invalid version");
-    if (virtio_reg_read32(VIRTIO_REG_DEVICE_ID) != VIRTIO_DEVICE_BLK)
+    if (virtio_reg_read32(VIRTIO_BLK_PADDR, VIRTIO_REG_DEVICE_ID) != VIRTIO_DEVICE_BLK)
         PANIC("virtio: invalid device id");
 
-    virtio_reg_write32(VIRTIO_REG_DEVICE_STATUS, 0);
-    virtio_reg_fetch_and_or32(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACK);
-    virtio_reg_fetch_and_or32(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_DRIVER);
-    virtio_reg_fetch_and_or32(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FEAT_OK);
-    blk_request_vq = virtq_init(0);
-    virtio_reg_write32(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_DRIVER_OK);
+    virtio_device_begin(VIRTIO_BLK_PADDR);
+    blk_request_vq = virtq_init(VIRTIO_BLK_PADDR, 0);
+    virtio_reg_write32(VIRTIO_BLK_PADDR, VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_DRIVER_OK);
 
-    blk_capacity = virtio_reg_read64(VIRTIO_REG_DEVICE_CONFIG + 0) * SECTOR_SIZE;
-    printf("virtio-blk: capacity is %d bytes\n", blk_capacity);
+    blk_capacity = virtio_reg_read64(VIRTIO_BLK_PADDR, VIRTIO_REG_DEVICE_CONFIG + 0) * SECTOR_SIZE;
+    printf("virtio-blk: capacity is %u bytes\n", blk_capacity);
 
-    blk_req_paddr = alloc_pages(align_up(sizeof(*blk_req), PAGE_SIZE) / PAGE_SIZE);
-    blk_req = (struct virtio_blk_req *) blk_req_paddr;
+    blk_reqs_paddr = alloc_pages(
+        align_up(sizeof(*blk_reqs) * VIRTIO_BLK_REQ_MAX, PAGE_SIZE) / PAGE_SIZE);
+    blk_reqs = (struct virtio_blk_req *) blk_reqs_paddr;
+    for (int i = 0; i < VIRTIO_BLK_REQ_MAX; i++)
+        blk_inflight[i].hdr = &blk_reqs[i];
 }
 
-struct virtio_virtq *virtq_init(unsigned index) {
+struct virtio_virtq *virtq_init(paddr_t base, unsigned index) {
     paddr_t virtq_paddr = alloc_pages(align_up(sizeof(struct virtio_virtq), PAGE_SIZE) / PAGE_SIZE);
     struct virtio_virtq *vq = (struct virtio_virtq *) virtq_paddr;
+    vq->mmio_base = base;
     vq->queue_index = index;
     vq->used_index = (volatile uint16_t *) &vq->used.index;
-    virtio_reg_write32(VIRTIO_REG_QUEUE_SEL, index);
-    virtio_reg_write32(VIRTIO_REG_QUEUE_NUM, VIRTQ_ENTRY_NUM);
-    virtio_reg_write32(VIRTIO_REG_QUEUE_ALIGN, 0);
-    virtio_reg_write32(VIRTIO_REG_QUEUE_PFN, virtq_paddr);
+    for (int i = 0; i < VIRTQ_ENTRY_NUM; i++)
+        vq->descs[i].next = i + 1;
+    vq->free_head = 0;
+    vq->num_free = VIRTQ_ENTRY_NUM;
+    virtio_reg_write32(base, VIRTIO_REG_QUEUE_SEL, index);
+    virtio_reg_write32(base, VIRTIO_REG_QUEUE_NUM, VIRTQ_ENTRY_NUM);
+    virtio_reg_write32(base, VIRTIO_REG_QUEUE_ALIGN, 0);
+    virtio_reg_write32(base, VIRTIO_REG_QUEUE_PFN, virtq_paddr);
     return vq;
 }
 
-void virtq_kick(struct virtio_virtq *vq, int desc_index) {
+// 從 free list 取出 n 個 descriptor 串成一條鏈，回傳 head；不夠時回傳 -1
+int virtq_alloc_chain(struct virtio_virtq *vq, int n) {
+    if (vq->num_free < n)
+        return -1;
+    int head = vq->free_head;
+    int desc = head;
+    for (int i = 0; i < n; i++) {
+        vq->descs[desc].flags = i < n - 1 ? VIRTQ_DESC_F_NEXT : 0;
+        if (i < n - 1)
+            desc = vq->descs[desc].next;
+    }
+    vq->free_head = vq->descs[desc].next;
+    vq->num_free -= n;
+    return head;
+}
+
+void virtq_free_chain(struct virtio_virtq *vq, int head) {
+    int desc = head;
+    int n = 1;
+    while (vq->descs[desc].flags & VIRTQ_DESC_F_NEXT) {
+        desc = vq->descs[desc].next;
+        n++;
+    }
+    vq->descs[desc].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += n;
+}
+
+// 只放進 avail ring，不通知裝置
+void virtq_post(struct virtio_virtq *vq, int desc_index) {
     vq->avail.ring[vq->avail.index % VIRTQ_ENTRY_NUM] = desc_index;
+    __sync_synchronize();
     vq->avail.index++;
+}
+
+void virtq_notify(struct virtio_virtq *vq) {
     __sync_synchronize();
-    virtio_reg_write32(VIRTIO_REG_QUEUE_NOTIFY, vq->queue_index);
-    vq->last_used_index++;
+    virtio_reg_write32(vq->mmio_base, VIRTIO_REG_QUEUE_NOTIFY, vq->queue_index);
 }
 
+void virtq_kick(struct virtio_virtq *vq, int desc_index) {
+    virtq_post(vq, desc_index);
+    virtq_notify(vq);
+}
+
+// 裝置是否還有尚未回收的 used entry
 bool virtq_is_busy(struct virtio_virtq *vq) {
     return vq->last_used_index != *vq->used_index;
 }
 
-void read_write_disk(void *buf, unsigned sector, int is_write) {
-    if (sector >= blk_capacity / SECTOR_SIZE) {
-        printf("virtio: tried to read/write sector=%d, but capacity is %d\n",
-              sector, blk_capacity / SECTOR_SIZE);
+// 開機階段（尚無進程）或 idle 不能睡眠，只能忙等
+static bool blk_can_sleep(void) {
+    return current_proc && current_proc != idle_proc;
+}
+
+// 一次回收 used ring 裡所有已完成的請求（呼叫者持有 blk_lock）
+void virtio_blk_harvest(void) {
+    struct virtio_virtq *vq = blk_request_vq;
+    while (virtq_is_busy(vq)) {
+        __sync_synchronize();
+        uint32_t id = vq->used.ring[vq->last_used_index % VIRTQ_ENTRY_NUM].id;
+        struct blk_request *req = blk_desc_owner[id];
+        blk_desc_owner[id] = NULL;
+        virtq_free_chain(vq, id);
+        if (req)
+            req->done = true;
+        vq->last_used_index++;
+    }
+}
+
+// virtio-blk 完成中斷：回應裝置、批次回收後喚醒所有等待中的進程
+void virtio_blk_handle_irq(void) {
+    spin_lock(&blk_lock);
+    uint32_t status = virtio_reg_read32(VIRTIO_BLK_PADDR, VIRTIO_REG_INTERRUPT_STATUS);
+    virtio_reg_write32(VIRTIO_BLK_PADDR, VIRTIO_REG_INTERRUPT_ACK, status);
+    virtio_blk_harvest();
+    wake_up(&blk_wait_queue);
+    spin_unlock(&blk_lock);
+}
+
+// 呼叫者持有 blk_lock；睡眠期間會暫時放開
+static void blk_wait_event(void) {
+    if (blk_can_sleep())
+        sleep_on(&blk_wait_queue, &blk_lock);
+    else
+        virtio_blk_harvest();
+}
+
+static void blk_notify_locked(void) {
+    if (blk_pending_notify == 0)
         return;
+    blk_pending_notify = 0;
+    virtq_notify(blk_request_vq);
+}
+
+// 把 iov 描述的資料串成一個 virtio 請求放到 avail ring，但不通知裝置。
+// 各段長度不限，但合計須為 SECTOR_SIZE 的倍數；可以連續呼叫多次，最後用
+// virtio_blk_notify() 一次通知。
+struct blk_request *virtio_blk_submitv(unsigned sector, const struct blk_iovec *iov,
+                                       int iovcnt, int is_write) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].len;
+    unsigned nsectors = len / SECTOR_SIZE;
+    if (iovcnt < 1 || iovcnt > BLK_MAX_SEGS || len % SECTOR_SIZE != 0) {
+        printf("virtio: invalid request (%d segments, %d bytes)\n", iovcnt, len);
+        return NULL;
     }
-    blk_req->sector = sector;
-    blk_req->type = is_write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
-    if (is_write)
-        memcpy(blk_req->data, buf, SECTOR_SIZE);
+    if (sector + nsectors > blk_capacity / SECTOR_SIZE) {
+        printf("virtio: tried to read/write sector=%d+%d, but capacity is %d\n",
+              sector, nsectors, blk_capacity / SECTOR_SIZE);
+        return NULL;
+    }
+
     struct virtio_virtq *vq = blk_request_vq;
-    vq->descs[0].addr = blk_req_paddr;
-    vq->descs[0].len = sizeof(uint32_t) * 2 + sizeof(uint64_t);
-    vq->descs[0].flags = VIRTQ_DESC_F_NEXT;
-    vq->descs[0].next = 1;
-    vq->descs[1].addr = blk_req_paddr + offsetof(struct virtio_blk_req, data);
-    vq->descs[1].len = SECTOR_SIZE;
-    vq->descs[1].flags = VIRTQ_DESC_F_NEXT | (is_write ? 0 : VIRTQ_DESC_F_WRITE);
-    vq->descs[1].next = 2;
-    vq->descs[2].addr = blk_req_paddr + offsetof(struct virtio_blk_req, status);
-    vq->descs[2].len = sizeof(uint8_t);
-    vq->descs[2].flags = VIRTQ_DESC_F_WRITE;
-    virtq_kick(vq, 0);
-    while (virtq_is_busy(vq))
-        ;
-    if (blk_req->status != 0) {
-        printf("virtio: warn: failed to read/write sector=%d status=%d\n",
-               sector, blk_req->status);
-        return;
+    struct blk_request *req = NULL;
+    int head;
+    spin_lock(&blk_lock);
+    while (1) {
+        for (int i = 0; i < VIRTIO_BLK_REQ_MAX && !req; i++) {
+            if (!blk_inflight[i].in_use)
+                req = &blk_inflight[i];
+        }
+        if (req && (head = virtq_alloc_chain(vq, iovcnt + 2)) >= 0)
+            break;
+        req = NULL;
+        // 資源不足：先把已排隊的請求交給裝置，否則可能永遠等不到完成
+        blk_notify_locked();
+        blk_wait_event();
+    }
+
+    struct virtio_blk_req *hdr = req->hdr;
+    paddr_t hdr_paddr = (paddr_t) hdr;
+    req->in_use = true;
+    req->done = false;
+    req->sector = sector;
+    req->nsectors = nsectors;
+    req->is_write = is_write;
+    hdr->sector = sector;
+    hdr->type = is_write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    hdr->status = 0xff;
+
+    int desc = head;
+    vq->descs[desc].addr = hdr_paddr;
+    vq->descs[desc].len = sizeof(uint32_t) * 2 + sizeof(uint64_t);
+    vq->descs[desc].flags = VIRTQ_DESC_F_NEXT;
+    for (int i = 0; i < iovcnt; i++) {
+        desc = vq->descs[desc].next;
+        vq->descs[desc].addr = (paddr_t) iov[i].base;
+        vq->descs[desc].len = iov[i].len;
+        vq->descs[desc].flags = VIRTQ_DESC_F_NEXT | (is_write ? 0 : VIRTQ_DESC_F_WRITE);
+    }
+    desc = vq->descs[desc].next;
+    vq->descs[desc].addr = hdr_paddr + offsetof(struct virtio_blk_req, status);
+    vq->descs[desc].len = sizeof(uint8_t);
+    vq->descs[desc].flags = VIRTQ_DESC_F_WRITE;
+
+    blk_desc_owner[head] = req;
+    virtq_post(vq, head);
+    blk_pending_notify++;
+    spin_unlock(&blk_lock);
+    return req;
+}
+
+struct blk_request *virtio_blk_submit(void *buf, unsigned sector, int is_write) {
+    struct blk_iovec iov = { .base = buf, .len = SECTOR_SIZE };
+    return virtio_blk_submitv(sector, &iov, 1, is_write);
+}
+
+void virtio_blk_notify(void) {
+    spin_lock(&blk_lock);
+    blk_notify_locked();
+    spin_unlock(&blk_lock);
+}
+
+// 等待請求完成並釋放；回傳裝置的 status（0 表示成功）
+int virtio_blk_wait(struct blk_request *req) {
+    spin_lock(&blk_lock);
+    blk_notify_locked();
+    while (!req->done)
+        blk_wait_event();
+
+    int status = req->hdr->status;
+    if (status != 0) {
+        printf("virtio: warn: failed to read/write sector=%d+%d status=%d\n",
+               req->sector, req->nsectors, status);
     }
-    if (!is_write)
-        memcpy(buf, blk_req->data, SECTOR_SIZE);
-}
\ No newline at end of file
+    req->in_use = false;
+    wake_up(&blk_wait_queue);
+    spin_unlock(&blk_lock);
+    return status;
+}
+
+static int blk_rwv(unsigned sector, const struct blk_iovec *iov, int iovcnt,
+                   int is_write) {
+    struct blk_request *req = virtio_blk_submitv(sector, iov, iovcnt, is_write);
+    if (!req)
+        return -1;
+    return virtio_blk_wait(req) == 0 ? 0 : -1;
+}
+
+// 多段（scatter-gather）讀寫，整批只算一個 virtio 請求；成功回傳 0
+int blk_readv(unsigned sector, const struct blk_iovec *iov, int iovcnt) {
+    return blk_rwv(sector, iov, iovcnt, false);
+}
+
+int blk_writev(unsigned sector, const struct blk_iovec *iov, int iovcnt) {
+    return blk_rwv(sector, iov, iovcnt, true);
+}
+
+// 從 sector 開始連續讀寫 len 個位元組（len 須為 SECTOR_SIZE 的倍數）
+int blk_read(unsigned sector, void *buf, size_t len) {
+    struct blk_iovec iov = { .base = buf, .len = len };
+    return blk_rwv(sector, &iov, 1, false);
+}
+
+int blk_write(unsigned sector, const void *buf, size_t len) {
+    struct blk_iovec iov = { .base = (void *) buf, .len = len };
+    return blk_rwv(sector, &iov, 1, true);
+}
+
+// 讀寫單一磁區，成功回傳 0
+int read_write_disk(void *buf, unsigned sector, int is_write) {
+    return blk_rwv(sector, &(struct blk_iovec){ .base = buf, .len = SECTOR_SIZE }, 1, is_write);
+}
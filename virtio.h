@@ -1,15 +1,39 @@
 #pragma once
 
-uint32_t virtio_reg_read32(unsigned offset);
-uint64_t virtio_reg_read64(unsigned offset);
-void virtio_reg_write32(unsigned offset, uint32_t value);
-void virtio_reg_fetch_and_or32(unsigned offset, uint32_t value);
+struct blk_iovec;
+struct blk_request;
+
+uint32_t virtio_reg_read32(paddr_t base, unsigned offset);
+uint64_t virtio_reg_read64(paddr_t base, unsigned offset);
+void virtio_reg_write32(paddr_t base, unsigned offset, uint32_t value);
+void virtio_reg_fetch_and_or32(paddr_t base, unsigned offset, uint32_t value);
+bool virtio_device_present(paddr_t base, uint32_t device_id);
+void virtio_device_begin(paddr_t base);
 extern struct virtio_virtq *blk_request_vq;
-extern struct virtio_blk_req *blk_req;
-extern paddr_t blk_req_paddr;
+extern struct virtio_blk_req *blk_reqs;
+extern paddr_t blk_reqs_paddr;
 extern unsigned blk_capacity;
 void virtio_blk_init(void);
-struct virtio_virtq *virtq_init(unsigned index);
+struct virtio_virtq *virtq_init(paddr_t base, unsigned index);
+int virtq_alloc_chain(struct virtio_virtq *vq, int n);
+void virtq_free_chain(struct virtio_virtq *vq, int head);
+void virtq_post(struct virtio_virtq *vq, int desc_index);
+void virtq_notify(struct virtio_virtq *vq);
 void virtq_kick(struct virtio_virtq *vq, int desc_index);
 bool virtq_is_busy(struct virtio_virtq *vq);
-void read_write_disk(void *buf, unsigned sector, int is_write);
\ No newline at end of file
+void virtio_blk_harvest(void);
+void virtio_blk_handle_irq(void);
+struct blk_request *virtio_blk_submitv(unsigned sector, const struct blk_iovec *iov,
+                                       int iovcnt, int is_write);
+struct blk_request *virtio_blk_submit(void *buf, unsigned sector, int is_write);
+void virtio_blk_notify(void);
+int virtio_blk_wait(struct blk_request *req);
+int blk_readv(unsigned sector, const struct blk_iovec *iov, int iovcnt);
+int blk_writev(unsigned sector, const struct blk_iovec *iov, int iovcnt);
+int blk_read(unsigned sector, void *buf, size_t len);
+int blk_write(unsigned sector, const void *buf, size_t len);
+int read_write_disk(void *buf, unsigned sector, int is_write);
+bool virtio_console_init(void);
+bool virtio_console_present(void);
+void virtio_console_handle_irq(void);
+int virtio_console_send(const void *hdr, size_t hdr_len, const void *data, size_t len);
@@ -0,0 +1,117 @@
+#include "kernel.h"
+#include "common.h"
+#include "virtio.h"
+#include "llm.h"
+
+// virtio-console（QEMU 的 virtconsole，埠 0），host 那頭接到 UNIX socket，
+// 用來和 llm_host_service.py 交換 LLM 訊框。不協商 MULTIPORT，只用
+// receiveq(0) 與 transmitq(1)；QEMU 在 DRIVER_OK 時就把埠 0 視為已開啟。
+#define VCON_RX_BUFS     8
+#define VCON_RX_BUF_SIZE (PAGE_SIZE / VCON_RX_BUFS)
+
+static struct virtio_virtq *vcon_rx_vq;
+static struct virtio_virtq *vcon_tx_vq;
+static uint8_t *vcon_tx_buf;   // 一次只送一段，送出前先複製到這裡
+static bool vcon_tx_busy;
+static bool vcon_present;
+static struct wait_queue vcon_tx_wait_queue;
+// 保護兩個 virtqueue 與 vcon_tx_busy；收到的資料在持有它時交給 llm.c
+static struct spinlock vcon_lock;
+
+bool virtio_console_present(void) {
+    return vcon_present;
+}
+
+// 沒有接 virtconsole 時回傳 false，LLM 繼續走磁碟上的請求環
+bool virtio_console_init(void) {
+    if (!virtio_device_present(VIRTIO_CONSOLE_PADDR, VIRTIO_DEVICE_CONSOLE))
+        return false;
+
+    virtio_device_begin(VIRTIO_CONSOLE_PADDR);
+    vcon_rx_vq = virtq_init(VIRTIO_CONSOLE_PADDR, 0);
+    vcon_tx_vq = virtq_init(VIRTIO_CONSOLE_PADDR, 1);
+    virtio_reg_write32(VIRTIO_CONSOLE_PADDR, VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_DRIVER_OK);
+
+    // 接收緩衝區的 descriptor 固定配給各自的緩衝區，收完直接重新放回 avail ring
+    uint8_t *rx_bufs = (uint8_t *) alloc_pages(1);
+    for (int i = 0; i < VCON_RX_BUFS; i++) {
+        int desc = virtq_alloc_chain(vcon_rx_vq, 1);
+        vcon_rx_vq->descs[desc].addr = (paddr_t) (rx_bufs + i * VCON_RX_BUF_SIZE);
+        vcon_rx_vq->descs[desc].len = VCON_RX_BUF_SIZE;
+        vcon_rx_vq->descs[desc].flags = VIRTQ_DESC_F_WRITE;
+        virtq_post(vcon_rx_vq, desc);
+    }
+    virtq_notify(vcon_rx_vq);
+
+    vcon_tx_buf = (uint8_t *) alloc_pages(1);
+    vcon_present = true;
+    printf("virtio-console: attached at %p\n", VIRTIO_CONSOLE_PADDR);
+    return true;
+}
+
+// 呼叫者持有 vcon_lock
+static void vcon_tx_harvest(void) {
+    while (virtq_is_busy(vcon_tx_vq)) {
+        __sync_synchronize();
+        uint32_t id = vcon_tx_vq->used.ring[vcon_tx_vq->last_used_index % VIRTQ_ENTRY_NUM].id;
+        virtq_free_chain(vcon_tx_vq, id);
+        vcon_tx_vq->last_used_index++;
+        vcon_tx_busy = false;
+    }
+}
+
+// 呼叫者持有 vcon_lock
+static void vcon_rx_harvest(void) {
+    bool reposted = false;
+    while (virtq_is_busy(vcon_rx_vq)) {
+        __sync_synchronize();
+        struct virtq_used_elem *e =
+            &vcon_rx_vq->used.ring[vcon_rx_vq->last_used_index % VIRTQ_ENTRY_NUM];
+        uint32_t id = e->id;
+        llm_console_receive((const uint8_t *) (paddr_t) vcon_rx_vq->descs[id].addr, e->len);
+        virtq_post(vcon_rx_vq, id);
+        vcon_rx_vq->last_used_index++;
+        reposted = true;
+    }
+    if (reposted)
+        virtq_notify(vcon_rx_vq);
+}
+
+void virtio_console_handle_irq(void) {
+    spin_lock(&vcon_lock);
+    uint32_t status = virtio_reg_read32(VIRTIO_CONSOLE_PADDR, VIRTIO_REG_INTERRUPT_STATUS);
+    virtio_reg_write32(VIRTIO_CONSOLE_PADDR, VIRTIO_REG_INTERRUPT_ACK, status);
+    vcon_tx_harvest();
+    vcon_rx_harvest();
+    if (!vcon_tx_busy)
+        wake_up(&vcon_tx_wait_queue);
+    spin_unlock(&vcon_lock);
+}
+
+// 送出一則訊息：hdr 後面接著 data，合計最多一頁。整則訊息放在同一個
+// descriptor 裡，不會和其他送出者的訊息交錯；複製到 vcon_tx_buf 後就回傳，
+// 不等 host 讀走。
+int virtio_console_send(const void *hdr, size_t hdr_len, const void *data, size_t len) {
+    if (!vcon_present || hdr_len + len > PAGE_SIZE)
+        return -1;
+
+    spin_lock(&vcon_lock);
+    while (vcon_tx_busy) {
+        // 開機階段（尚無進程）不能睡眠，只能忙等
+        if (current_proc && current_proc != idle_proc)
+            sleep_on(&vcon_tx_wait_queue, &vcon_lock);
+        else
+            vcon_tx_harvest();
+    }
+
+    memcpy(vcon_tx_buf, hdr, hdr_len);
+    memcpy(vcon_tx_buf + hdr_len, data, len);
+    int desc = virtq_alloc_chain(vcon_tx_vq, 1);
+    vcon_tx_vq->descs[desc].addr = (paddr_t) vcon_tx_buf;
+    vcon_tx_vq->descs[desc].len = hdr_len + len;
+    vcon_tx_vq->descs[desc].flags = 0;
+    vcon_tx_busy = true;
+    virtq_kick(vcon_tx_vq, desc);
+    spin_unlock(&vcon_lock);
+    return 0;
+}